@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <mpv/client.h>
+#include <mpv/render.h>
 #include <gtk/gtk.h>
 #include <gdk/gdkx.h>
 #include <unistd.h>
@@ -9,12 +10,139 @@
 #include <errno.h>
 #include <stdint.h>
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <gdk/gdk.h>
 #include <dirent.h> // For directory operations
+#include <fcntl.h>
+#include <glob.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include <limits.h>
+#include <stdatomic.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+// Bits telling the GTK side which widgets need refreshing after a property change
+enum {
+    UI_DIRTY_POSITION = 1 << 0, // slider value, time label
+    UI_DIRTY_DURATION = 1 << 1, // slider range, time label
+    UI_DIRTY_PAUSE    = 1 << 2, // play/pause icon
+    UI_DIRTY_VOLUME   = 1 << 3, // volume slider
+    UI_DIRTY_TRACKS   = 1 << 4, // track buttons
+    UI_DIRTY_PATH     = 1 << 5, // window title
+    UI_DIRTY_PLAYLIST = 1 << 6, // playlist cursor and highlighted row
+    UI_DIRTY_SEEK     = 1 << 7, // playback restarted, the seek in flight has landed
+    UI_DIRTY_PLAYING  = 1 << 8, // started, paused or stopped: session autosave timer
+    // Player state rather than widgets: applied from an idle, since the frame
+    // clock stops while the window is hidden or minimized
+    UI_STATE_BITS     = UI_DIRTY_PLAYLIST | UI_DIRTY_SEEK | UI_DIRTY_PLAYING
+};
+
+// Plain copy of the observed player state, cheap to take on the GTK thread
+typedef struct {
+    double time_pos;
+    double duration;
+    double volume;
+    gboolean pause;
+    gboolean eof_reached;
+    int video_tracks;
+    int audio_tracks;
+    int sub_tracks;
+    gint64 playlist_pos; // Index in mpv's playlist, -1 if none
+    int video_width;     // Display size of the video (dwidth/dheight), 0 if none
+    int video_height;
+    char aid[8];         // Selected tracks as mpv spells them ("auto", "no", "2")
+    char sid[8];
+    char vid[8];
+    char path[PATH_MAX]; // Empty when nothing is loaded
+} PlayerSnapshot;
+
+// Latest values of the observed properties. mpv_thread is the only writer;
+// readers never block it and retry if they overlapped an update (seqlock).
+typedef struct {
+    atomic_uint seq; // Odd while an update is in progress
+    PlayerSnapshot data;
+} PlayerState;
+
+// Software scaler for frames mpv hands us unscaled (see --sw-scaler)
+typedef enum {
+    SCALE_NEAREST,
+    SCALE_BILINEAR,
+    SCALE_AREA,
+    SCALE_MODE_COUNT
+} ScaleMode;
+
+// mpv's 32-bit software formats, named by byte order in memory
+typedef enum {
+    PIXEL_BGR0,
+    PIXEL_RGB0
+} PixelLayout;
+
+// Grow-only tables and row buffers, so scaling a stream of frames allocates nothing
+typedef struct {
+    int32_t *x0, *x1;   // Source columns feeding each destination column
+    int16_t *wx;        // Bilinear (w0, w1) weight pair per destination column
+    int16_t *rows[2];   // Horizontally filtered source rows (bilinear)
+    int row_y[2];       // Source row held in rows[i], -1 if none
+    uint32_t *colsum;   // Per source column and channel sums (area)
+    int columns;        // Destination columns the tables have room for
+    int src_columns;    // Source columns colsum has room for
+} ScaleScratch;
 
-#define SCRIPT_DIR "/home/max/Documents/Eluxi/script_modules"
+typedef struct {
+    const uint8_t *src;
+    int src_width, src_height, src_stride;
+    uint8_t *dst;       // Cairo ARGB32 (premultiplied, native endian)
+    int dst_width, dst_height, dst_stride;
+    PixelLayout layout;
+    ScaleScratch *scratch;
+} ScaleJob;
+
+// Row kernels of one instruction set; the per-frame loops are shared
+typedef struct {
+    const char *name;
+    void (*nearest_row)(uint32_t *dst, const uint32_t *src, const int32_t *xmap, int width, PixelLayout layout);
+    void (*bilinear_hrow)(int16_t *dst, const uint32_t *src, const int32_t *x0, const int32_t *x1,
+                          const int16_t *wx, int width);
+    void (*bilinear_vrow)(uint32_t *dst, const int16_t *top, const int16_t *bottom, int wy1, int width,
+                          PixelLayout layout);
+    void (*area_accumulate)(uint32_t *colsum, const uint8_t *src, int src_width);
+    void (*area_reduce)(uint32_t *dst, const uint32_t *colsum, const int32_t *x0, const int32_t *x1,
+                        int box_height, int width, PixelLayout layout);
+} ScalerImpl;
+
+#define FRAME_POOL_SIZE 3   // One being drawn, one ready, one being rendered
+#define FRAME_STRIDE_ALIGN 64
+
+// Ring of preallocated frame buffers shared by the render thread and
+// on_draw_frame. Each slot is a cairo surface wrapping 64-byte aligned rows.
+typedef struct {
+    GMutex lock;
+    GCond wake;
+    GThread *thread;
+    gboolean quit;
+    gboolean update_pending;  // mpv signalled its render update callback
+    gboolean resized;         // width/height changed, slots must be reallocated
+    int width, height;        // drawing_area allocation in device pixels
+    int scale;                // Device pixels per logical pixel
+    cairo_surface_t *slots[FRAME_POOL_SIZE];
+    int latest;               // Newest complete frame, -1 if none
+    int drawing;              // Slot on_draw_frame is painting, -1 if none
+    gint redraw_queued;       // on_frame_ready_idle already scheduled
+    cairo_format_t format;    // RGB24 when mpv scales, ARGB32 from our scaler
+    int scale_mode;           // ScaleMode, or -1 to let mpv scale to the slot size
+    const ScalerImpl *scaler;
+    ScaleScratch scratch;
+    uint8_t *source;          // Unscaled frame from mpv, owned by the render thread
+    int source_width, source_height, source_stride;
+} FramePool;
 
 // Structure to hold our MPV and GTK+ data
+typedef struct SessionResume SessionResume;
+
 typedef struct {
     mpv_handle *mpv;
     GtkWidget *window;
@@ -28,13 +156,28 @@ typedef struct {
     GtkWidget *stop_button;
     GtkWidget *file_icon;
     GtkWidget *file_button;
+    GtkWidget *folder_button;
     GtkWidget *slider;
     GtkWidget *duration_label;
+    gint64 shown_position_sec;    // Whole seconds currently in duration_label, -1 if none
+    gint64 shown_duration_sec;
     gulong slider_handler_id;
     gboolean slider_dragging;
+    gboolean seek_in_flight;      // A seek was sent and mpv has not restarted playback yet
+    gboolean seek_queued;         // seek_target still has to be sent
+    gboolean seek_exact;
+    double seek_target;
+    GtkWidget *preview_window;    // Seek preview popup over the slider
+    GtkWidget *preview_area;
+    GtkWidget *preview_label;
+    int preview_index;            // Thumbnail shown in preview_area, -1 if none
+    int preview_x;                // Pointer x the popup was placed for, -1 while hidden
+    int preview_seconds;          // Time shown in preview_label
     GtkWidget *volume_slider;
     GtkWidget *volume_icon;
-    GtkWidget *playlist_box;
+    GtkWidget *playlist_popover;  // Pops up from playlist_button
+    GtkWidget *playlist_view;     // GtkTreeView over playlist_store
+    GtkListStore *playlist_store; // One row per PlaylistEntry
     GtkWidget *playlist_button;
     GtkWidget *playlist_icon;
     GtkWidget *hover_box;
@@ -44,48 +187,200 @@ typedef struct {
     GtkWidget *fullscreen_icon;
     GtkWidget *subtitle_button;
     GtkWidget *subtitle_icon;
-    GtkWidget *current_playlist_item; // New: Store the currently playing button
-    gboolean manual_selection;
-    gboolean waiting_for_manual_load;
+    guint playing_entry_id;       // Entry whose row is highlighted, 0 if none
+    gboolean gapless;             // Playlist is mirrored into mpv's own playlist
+    gboolean mpv_playlist_synced; // mpv's playlist currently matches ours
+    gboolean mpv_list_in_flight;  // A loadlist has been sent and not replied to
+    gboolean mpv_mirroring;       // ... and it is mirror_playlist_to_mpv's
+    gboolean mpv_mirror_stale;    // Our playlist was replaced while it loaded
+    gboolean mpv_mirror_wanted;   // Mirror (and play) again once it has replied
+    guint mpv_sent_length;        // Our entries mpv has or is loading; later ones are still to send
+    guint mpv_loaded_length;      // ... of which mpv has confirmed loading
+    GMutex pending_lock;          // Guards pending_requests and next_reply_id
+    GHashTable *pending_requests; // reply id -> PendingRequest
+    uint64_t next_reply_id;
     GtkWidget *video_track_button; // New
     GtkWidget *video_track_icon;   // New
     GtkWidget *audio_track_button; // New
     GtkWidget *audio_track_icon;   // New
+    GMainContext *mpv_event_context; // Owned by mpv_thread
+    GMainLoop *mpv_event_loop;
+    GSource *mpv_event_source;       // Made ready by on_mpv_wakeup
+    PlayerState state;               // Written by mpv_thread, read by GTK
+    guint ui_dirty;                  // UI_DIRTY_* bits not yet applied to widgets
+    guint ui_tick_id;                // Frame-clock callback flushing ui_dirty
+    guint state_dirty;               // UI_STATE_BITS not yet applied
+    guint session_timer;             // session_autosave while playing, 0 otherwise
+    guint session_save_id;           // Pending save after a playlist change
+    gboolean session_playlist_saved; // The session file holds the current entries
+    gboolean sw_render;              // Video drawn through mpv_render_context instead of wid
+    mpv_render_context *render_ctx;  // Software render context (sw_render only)
+    FramePool frames;                // Buffers mpv renders into (sw_render only)
+    SessionResume *resume;           // For the on_load hook, taken by whichever thread applies it
+    GMutex watched_lock;             // Guards watched, which the event thread keeps current
+    PlayerSnapshot watched;          // Resume point of the playing file; time_pos < 0 until known
+    gboolean watched_closed;         // Event thread only: unloaded, ignore the file's late events
 } AppData;
 
-typedef struct {
-    char **tracks;
-    int count;
-} SubtitleTracks;
+typedef enum {
+    TRACK_VIDEO,
+    TRACK_AUDIO,
+    TRACK_SUB,
+    TRACK_TYPE_COUNT
+} TrackType;
 
+// One entry of mpv's track-list
 typedef struct {
-    char **tracks;
-    int count;
-} VideoTracks;
-
+    gint64 id;           // What vid/aid/sid take; unique within a type
+    TrackType type;
+    char *lang;          // NULL when mpv doesn't know
+    char *title;
+    char *codec;
+    gboolean is_default;
+    gboolean forced;
+    gboolean selected;
+} TrackInfo;
+
+// The current track-list, parsed once per change on the event thread and
+// replaced as a whole. Readers take a reference under the lock and use the
+// array without holding it.
 typedef struct {
-    char **tracks;
-    int count;
-} AudioTracks;
+    GMutex lock;
+    GArray *tracks;      // TrackInfo in mpv's order, NULL before the first file
+    guint generation[TRACK_TYPE_COUNT]; // Bumped when that type's tracks change
+} TrackModel;
 
+static TrackModel track_model;
+
+// A built track menu and what it was built from (GTK thread only)
 typedef struct {
-    VideoTracks tracks;
-} VideoTrackCleanupData;
+    GtkWidget *menu;
+    guint generation;    // track_model.generation of its type at build time
+    gint64 selected;     // ID of the marked item, 0 for "None"
+} TrackMenu;
+
+static TrackMenu track_menus[TRACK_TYPE_COUNT];
 
+// One playlist entry. The id is assigned once and never reused, so widgets
+// can refer to an entry without caring where it currently sits in the list.
 typedef struct {
-    AudioTracks tracks;
-} AudioTrackCleanupData;
+    guint id;
+    char *path;
+    char *title;     // From a playlist file, NULL if none
+    double duration; // Seconds, from a playlist file or the prober; -1 if unknown
+    GtkTreeIter row; // Its row in the playlist view (list store iters persist)
+} PlaylistEntry;
+
+// The play queue: entries in play order plus an id -> index map and a cursor
+typedef struct {
+    GArray *entries;      // PlaylistEntry
+    GHashTable *index_of; // entry id -> index + 1
+    guint next_id;        // Ids start at 1 so 0 can mean "no entry"
+    gint current;         // Index of the current entry, -1 if none
+} Playlist;
+
+static Playlist playlist = {NULL, NULL, 1, -1};
+
+// Columns of AppData.playlist_store
+enum {
+    PLAYLIST_COL_ID,      // guint entry id
+    PLAYLIST_COL_PATH,    // Displayed title, or the file path if there is none
+    PLAYLIST_COL_PLAYING, // TRUE for the highlighted row
+    PLAYLIST_COL_INFO,    // Duration, size, codecs; empty until probed
+    PLAYLIST_N_COLS
+};
+
+static void playlist_entry_clear(gpointer data) {
+    PlaylistEntry *entry = (PlaylistEntry *)data;
+    g_free(entry->path);
+    g_free(entry->title);
+}
 
+static void playlist_init(void) {
+    playlist.entries = g_array_new(FALSE, FALSE, sizeof(PlaylistEntry));
+    g_array_set_clear_func(playlist.entries, playlist_entry_clear);
+    playlist.index_of = g_hash_table_new(g_direct_hash, g_direct_equal);
+    playlist.current = -1;
+}
+
+static void playlist_clear(void) {
+    g_array_set_size(playlist.entries, 0);
+    g_hash_table_remove_all(playlist.index_of);
+    playlist.current = -1;
+}
+
+static guint playlist_length(void) {
+    return playlist.entries->len;
+}
+
+static PlaylistEntry *playlist_get(gint index) {
+    if (index < 0 || (guint)index >= playlist.entries->len) {
+        return NULL;
+    }
+    return &g_array_index(playlist.entries, PlaylistEntry, index);
+}
+
+// Index of the entry with the given id, or -1 if it is not in the playlist
+static gint playlist_index_of(guint id) {
+    return GPOINTER_TO_INT(g_hash_table_lookup(playlist.index_of, GUINT_TO_POINTER(id))) - 1;
+}
+
+// Append a copy of path (and title, which may be NULL) and return the new entry's id
+static guint playlist_append(const char *path, const char *title, double duration) {
+    PlaylistEntry entry = {playlist.next_id++, g_strdup(path), g_strdup(title), duration, {0}};
+    g_array_append_val(playlist.entries, entry);
+    g_hash_table_insert(playlist.index_of, GUINT_TO_POINTER(entry.id),
+                        GINT_TO_POINTER(playlist.entries->len));
+    return entry.id;
+}
+
+// Remove the entry at index. Later entries shift down one slot, so their
+// indices in the id map are rewritten; ids themselves never change.
+static void playlist_remove(gint index) {
+    PlaylistEntry *entry = playlist_get(index);
+    if (!entry) {
+        return;
+    }
+    g_hash_table_remove(playlist.index_of, GUINT_TO_POINTER(entry->id));
+    g_array_remove_index(playlist.entries, index);
+    for (guint i = index; i < playlist.entries->len; ++i) {
+        PlaylistEntry *moved = &g_array_index(playlist.entries, PlaylistEntry, i);
+        g_hash_table_insert(playlist.index_of, GUINT_TO_POINTER(moved->id), GINT_TO_POINTER(i + 1));
+    }
+    // Keep "next" pointing at whatever followed the removed entry
+    if (playlist.current >= index) {
+        playlist.current--;
+    }
+}
 
-// Function declarations (prototypes)
-void load_mpv_script(mpv_handle *mpv, const char *script_path);
-void load_lua_scripts(mpv_handle *mpv);
+static PlaylistEntry *playlist_current_entry(void) {
+    return playlist_get(playlist.current);
+}
 
+static void sidecar_prefetch(const char *path);
+
+// Also starts listing subtitle sidecars for this entry and the one after it
+static PlaylistEntry *playlist_set_current(gint index) {
+    PlaylistEntry *entry = playlist_get(index);
+    playlist.current = entry ? index : -1;
+    if (entry) {
+        sidecar_prefetch(entry->path);
+        PlaylistEntry *next = playlist_get(index + 1);
+        if (next) {
+            sidecar_prefetch(next->path);
+        }
+    }
+    return entry;
+}
 
-GList *video_queue = NULL;  // Queue of video filenames
-GList *current_video = NULL; // Pointer to the current video in the queue
-static GtkWidget *cached_vmenu = NULL;
-static GtkWidget *cached_amenu = NULL;
+// Move the cursor by delta (1 = next, -1 = previous). Returns the new current
+// entry, or NULL (and no current entry) when it runs off either end.
+static PlaylistEntry *playlist_advance(gint delta) {
+    if (playlist.current < 0) {
+        return NULL;
+    }
+    return playlist_set_current(playlist.current + delta);
+}
 
 // Global variables for cursor hiding
 static GdkCursor *normal_cursor = NULL;
@@ -120,512 +415,4625 @@ static gboolean reset_cursor_timer(GtkWidget *widget, GdkEventMotion *event, gpo
     return TRUE; // Continue processing the motion event
 }
 
-void load_mpv_script(mpv_handle *mpv, const char *script_path) {
-    const char *cmd[] = {"load-script", script_path, NULL};
-    printf("Attempting to load script: %s\n", script_path);
+// Startup profile: when each phase of startup finished, on the monotonic
+// clock, from the start of main(). Printed with --profile-startup once the
+// first file starts playing, or once the window has been drawn when there
+// is nothing to play.
+#define STARTUP_MAX_MARKS 32
 
-    int mpv_error = mpv_command(mpv, cmd);
-    if (mpv_error < 0) {
-        fprintf(stderr, "Failed to load Lua script: %s (MPV Error: %s)\n", script_path, mpv_error_string(mpv_error));
-    } else {
-        printf("Script loaded successfully: %s\n", script_path);
+typedef struct {
+    const char *phase;
+    gint64 time;
+} StartupMark;
+
+typedef struct {
+    GMutex lock;         // Marks come from the GTK, mpv startup and event threads
+    gint64 start;
+    StartupMark marks[STARTUP_MAX_MARKS];
+    guint count;
+    gint reported;       // Set once the profile is complete; later marks are dropped
+} StartupProfile;
+
+static StartupProfile startup_profile;
+static gboolean opt_profile_startup = FALSE;
+
+static void startup_mark(const char *phase) {
+    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&startup_profile.lock);
+    if (!startup_profile.reported && startup_profile.count < STARTUP_MAX_MARKS) {
+        startup_profile.marks[startup_profile.count++] = (StartupMark){phase, now};
+    }
+    g_mutex_unlock(&startup_profile.lock);
+}
+
+// Close the profile with its last phase and print it (once, any thread)
+static void startup_profile_report(const char *phase) {
+    if (g_atomic_int_get(&startup_profile.reported)) {
+        return;
+    }
+    startup_mark(phase);
+    g_mutex_lock(&startup_profile.lock);
+    gboolean first = !startup_profile.reported;
+    g_atomic_int_set(&startup_profile.reported, TRUE);
+    g_mutex_unlock(&startup_profile.lock);
+    if (!first || !opt_profile_startup) {
+        return;
+    }
+    printf("Startup profile (ms since main, ms since the previous phase):\n");
+    gint64 previous = startup_profile.start;
+    for (guint i = 0; i < startup_profile.count; ++i) {
+        const StartupMark *mark = &startup_profile.marks[i];
+        printf("  %9.2f %+9.2f  %s\n", (mark->time - startup_profile.start) / 1000.0,
+               (mark->time - previous) / 1000.0, mark->phase);
+        previous = mark->time;
     }
 }
 
+static gboolean report_startup_when_idle(gpointer data) {
+    startup_profile_report("window drawn, nothing to play");
+    return G_SOURCE_REMOVE;
+}
 
+static void on_volume_changed(GtkRange *range, AppData *app); // Declare the function
 
+// Reply ids for async requests start above every id used for property
+// observation, so the two kinds of replies can never be confused.
+#define ASYNC_REPLY_BASE 0x10000
 
-void load_lua_scripts(mpv_handle *mpv) {
-    DIR *dir;
-    struct dirent *ent;
+// Result of an asynchronous mpv request, handed to its callback on the GTK thread
+typedef struct {
+    int error;         // >= 0 on success, an mpv_error otherwise
+    gint64 received;   // g_get_monotonic_time() when mpv's answer came in
+    mpv_format format; // Format of value (property reads only)
+    union {
+        int flag;
+        int64_t int64;
+        double double_;
+        char *string;
+        mpv_node node;
+    } value;
+} MpvReply;
+
+typedef void (*MpvReplyCallback)(AppData *app, const MpvReply *reply, gpointer user_data);
 
-    if ((dir = opendir(SCRIPT_DIR)) != NULL) {
-        printf("Successfully opened script directory: %s\n", SCRIPT_DIR);
-        while ((ent = readdir(dir)) != NULL) {
-            if (strstr(ent->d_name, ".lua") != NULL) {
-                char script_path[4096];
-                snprintf(script_path, sizeof(script_path), "%s/%s", SCRIPT_DIR, ent->d_name);
-                printf("Found Lua script: %s\n", script_path);
-                load_mpv_script(mpv, script_path); // Pass full path now
+typedef struct {
+    AppData *app;
+    char *what; // Command or property name, for error messages
+    MpvReplyCallback callback;
+    gpointer user_data;
+    MpvReply reply;
+} PendingRequest;
+
+// Deep copy of an mpv_node into GLib-owned memory, so it outlives the event
+static void copy_mpv_node(mpv_node *dst, const mpv_node *src) {
+    dst->format = src->format;
+    switch (src->format) {
+        case MPV_FORMAT_STRING:
+        case MPV_FORMAT_OSD_STRING:
+            dst->u.string = g_strdup(src->u.string);
+            break;
+        case MPV_FORMAT_NODE_ARRAY:
+        case MPV_FORMAT_NODE_MAP: {
+            mpv_node_list *list = g_new0(mpv_node_list, 1);
+            list->num = src->u.list->num;
+            list->values = g_new0(mpv_node, list->num);
+            if (src->format == MPV_FORMAT_NODE_MAP) {
+                list->keys = g_new0(char *, list->num);
+            }
+            for (int i = 0; i < list->num; ++i) {
+                copy_mpv_node(&list->values[i], &src->u.list->values[i]);
+                if (list->keys) {
+                    list->keys[i] = g_strdup(src->u.list->keys[i]);
+                }
             }
+            dst->u.list = list;
+            break;
         }
-        closedir(dir);
-    } else {
-        perror("Could not open script directory");
-        printf("Error opening script directory: %s (Error: %s)\n", SCRIPT_DIR, strerror(errno));
+        case MPV_FORMAT_BYTE_ARRAY: {
+            mpv_byte_array *ba = g_new0(mpv_byte_array, 1);
+            ba->size = src->u.ba->size;
+            ba->data = g_memdup2(src->u.ba->data, ba->size);
+            dst->u.ba = ba;
+            break;
+        }
+        default:
+            dst->u = src->u;
+            break;
     }
 }
 
-
-static gboolean print_pause_state(gpointer data) {
-    printf("MPV: Pause state: %s\n", *(int *)data ? "yes" : "no");
-    return FALSE;
+static void free_copied_mpv_node(mpv_node *node) {
+    switch (node->format) {
+        case MPV_FORMAT_STRING:
+        case MPV_FORMAT_OSD_STRING:
+            g_free(node->u.string);
+            break;
+        case MPV_FORMAT_NODE_ARRAY:
+        case MPV_FORMAT_NODE_MAP:
+            for (int i = 0; i < node->u.list->num; ++i) {
+                free_copied_mpv_node(&node->u.list->values[i]);
+                if (node->u.list->keys) {
+                    g_free(node->u.list->keys[i]);
+                }
+            }
+            g_free(node->u.list->values);
+            g_free(node->u.list->keys);
+            g_free(node->u.list);
+            break;
+        case MPV_FORMAT_BYTE_ARRAY:
+            g_free(node->u.ba->data);
+            g_free(node->u.ba);
+            break;
+        default:
+            break;
+    }
+    node->format = MPV_FORMAT_NONE;
 }
 
-static gboolean print_duration(gpointer data) {
-    double duration = *(double *)data;
-    printf("MPV: Duration: %f\n", duration);
-    return FALSE;
+// Allocate a reply id and remember who wants to hear about it. Requests
+// nobody waits for get id 0 and no entry: their replies are only checked
+// for errors on the event thread, so bulk commands cost no bookkeeping and
+// no GTK wakeup each.
+static uint64_t register_request(AppData *app, const char *what, MpvReplyCallback callback, gpointer user_data) {
+    if (!callback) {
+        return 0;
+    }
+    PendingRequest *req = g_new0(PendingRequest, 1);
+    req->app = app;
+    req->what = g_strdup(what);
+    req->callback = callback;
+    req->user_data = user_data;
+
+    g_mutex_lock(&app->pending_lock);
+    uint64_t id = app->next_reply_id++;
+    g_hash_table_insert(app->pending_requests, g_memdup2(&id, sizeof(id)), req);
+    g_mutex_unlock(&app->pending_lock);
+    return id;
 }
 
-static void update_volume_slider(AppData *app); // Declare the function
+static void free_pending_request(PendingRequest *req) {
+    if (req->reply.format == MPV_FORMAT_STRING) {
+        g_free(req->reply.value.string);
+    } else if (req->reply.format == MPV_FORMAT_NODE) {
+        free_copied_mpv_node(&req->reply.value.node);
+    }
+    g_free(req->what);
+    g_free(req);
+}
 
-// Function to play the next file in the queue
-static gboolean play_next_in_queue(AppData *app) {
-    if (!app || !video_queue) {
-        printf("Queue empty. Nothing to play.\n");
-        return FALSE; // No more videos
+// Runs on the GTK thread with a request mpv has finished
+static gboolean dispatch_request_reply(gpointer data) {
+    PendingRequest *req = (PendingRequest *)data;
+    if (req->callback) {
+        req->callback(req->app, &req->reply, req->user_data);
+    } else if (req->reply.error < 0) {
+        fprintf(stderr, "MPV: %s failed: %s\n", req->what, mpv_error_string(req->reply.error));
     }
+    free_pending_request(req);
+    return G_SOURCE_REMOVE;
+}
 
-    if (!current_video) {
-        printf("No current video selected.\n");
-        return FALSE;
+// Hand a request that could not even be queued straight to its callback
+static void fail_request(AppData *app, uint64_t id, const char *what, int error) {
+    if (id == 0) {
+        fprintf(stderr, "MPV: %s failed: %s\n", what, mpv_error_string(error));
+        return;
     }
+    g_mutex_lock(&app->pending_lock);
+    PendingRequest *req = g_hash_table_lookup(app->pending_requests, &id);
+    g_hash_table_steal(app->pending_requests, &id);
+    g_mutex_unlock(&app->pending_lock);
+    if (req) {
+        req->reply.error = error;
+        req->reply.received = g_get_monotonic_time();
+        dispatch_request_reply(req);
+    }
+}
 
-    // Advance to the next video in the queue
-    current_video = g_list_next(current_video);
+// Called on mpv_thread for COMMAND/SET_PROPERTY/GET_PROPERTY replies. Copies
+// the result out of the event and queues the callback on the GTK thread.
+static void complete_async_request(AppData *app, mpv_event *event) {
+    uint64_t id = event->reply_userdata;
+    g_mutex_lock(&app->pending_lock);
+    PendingRequest *req = g_hash_table_lookup(app->pending_requests, &id);
+    g_hash_table_steal(app->pending_requests, &id);
+    g_mutex_unlock(&app->pending_lock);
+    if (!req) {
+        if (id == 0 && event->error < 0) { // Fire and forget, all that's left is to complain
+            fprintf(stderr, "MPV: %s failed: %s\n",
+                    event->event_id == MPV_EVENT_COMMAND_REPLY ? "command" : "property request",
+                    mpv_error_string(event->error));
+        }
+        return;
+    }
 
-    if (!current_video) {
-        printf("End of queue.\n");
-        // Optionally, you might want to:
-        // - Stop playback
-        mpv_command(app->mpv, (const char *[]){"stop", NULL});
-        // - Clear the playlist highlighting
-        if (app->current_playlist_item) {
-            GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-            gtk_style_context_remove_class(context, "playing-video");
-            app->current_playlist_item = NULL;
-        }
-        return FALSE; // End of queue
-    }
-
-    // Get the next file path
-    char *next_file = (char *)current_video->data;
-    printf("Now playing next file: %s\n", next_file);
-    if (next_file != NULL){
-    // Play the next file
-    const char *cmd[] = {"loadfile", next_file, NULL};
-    mpv_command(app->mpv, cmd);
-    }
-
-    // Update playlist highlighting
-    if (app->current_playlist_item) {
-        GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-        gtk_style_context_remove_class(context, "playing-video");
-    }
-
-    // Find the corresponding menu item and set its color
-    GList *children = gtk_container_get_children(GTK_CONTAINER(app->playlist_box));
-    for (GList *child = children; child != NULL; child = child->next) {
-        if (GTK_IS_MENU_ITEM(child->data)) {
-            const char *item_label = gtk_menu_item_get_label(GTK_MENU_ITEM(child->data));
-            if (item_label && strcmp(item_label, next_file) == 0) {
-                app->current_playlist_item = GTK_WIDGET(child->data);
-                GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-                gtk_style_context_add_class(context, "playing-video");
+    req->reply.error = event->error;
+    req->reply.received = g_get_monotonic_time();
+    if (event->event_id == MPV_EVENT_GET_PROPERTY_REPLY && event->error >= 0) {
+        mpv_event_property *prop = (mpv_event_property *)event->data;
+        req->reply.format = prop->format;
+        switch (prop->format) {
+            case MPV_FORMAT_FLAG:
+                req->reply.value.flag = *(int *)prop->data;
+                break;
+            case MPV_FORMAT_INT64:
+                req->reply.value.int64 = *(int64_t *)prop->data;
+                break;
+            case MPV_FORMAT_DOUBLE:
+                req->reply.value.double_ = *(double *)prop->data;
+                break;
+            case MPV_FORMAT_STRING:
+                req->reply.value.string = g_strdup(*(char **)prop->data);
+                break;
+            case MPV_FORMAT_NODE:
+                copy_mpv_node(&req->reply.value.node, (mpv_node *)prop->data);
+                break;
+            default:
+                req->reply.format = MPV_FORMAT_NONE;
                 break;
-            }
         }
     }
+    g_idle_add(dispatch_request_reply, req);
+}
 
-    return FALSE; // Only run once
+// Non-blocking replacements for mpv_command / mpv_set_property /
+// mpv_get_property. callback (may be NULL) runs later on the GTK thread.
+static void async_command(AppData *app, const char **args, MpvReplyCallback callback, gpointer user_data) {
+    uint64_t id = register_request(app, args[0], callback, user_data);
+    int err = mpv_command_async(app->mpv, id, args);
+    if (err < 0) {
+        fail_request(app, id, args[0], err);
+    }
 }
 
-// Function to play the next file in the queue
-static gboolean play_next_in_queue_false(AppData *app) {
+static void async_set_property(AppData *app, const char *name, mpv_format format, void *data,
+                               MpvReplyCallback callback, gpointer user_data) {
+    uint64_t id = register_request(app, name, callback, user_data);
+    int err = mpv_set_property_async(app->mpv, id, name, format, data); // data is copied by mpv
+    if (err < 0) {
+        fail_request(app, id, name, err);
+    }
+}
 
-    // Advance to the next video in the queue
-    current_video = g_list_next(video_queue);
+static void async_set_property_string(AppData *app, const char *name, const char *value) {
+    async_set_property(app, name, MPV_FORMAT_STRING, &value, NULL, NULL);
+}
 
-    if (!current_video) {
-        printf("End of queue.\n");
-        // Optionally, you might want to:
-        // - Stop playback
-        mpv_command(app->mpv, (const char *[]){"stop", NULL});
-        // - Clear the playlist highlighting
-        if (app->current_playlist_item) {
-            GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-            gtk_style_context_remove_class(context, "playing-video");
-            app->current_playlist_item = NULL;
-        }
-        return FALSE; // End of queue
-    }
-
-    // Get the next file path
-    char *next_file = (char *)current_video->data;
-    printf("Now playing next file: %s\n", next_file);
-    if (next_file != NULL){
-    // Play the next file
-    const char *cmd[] = {"loadfile", next_file, NULL};
-    mpv_command(app->mpv, cmd);
-    if (g_list_length(video_queue) >= 3) {
-        // There are at least three elements in the list
-        printf("The list contains at least three elements.\n");
-    } else {
-        // There are fewer than three elements in the list
-        printf("The list contains fewer than three elements.\n");
-        video_queue = NULL;
-        g_free(video_queue);
-        g_list_free(video_queue);
+static void async_get_property(AppData *app, const char *name, mpv_format format,
+                               MpvReplyCallback callback, gpointer user_data) {
+    uint64_t id = register_request(app, name, callback, user_data);
+    int err = mpv_get_property_async(app->mpv, id, name, format);
+    if (err < 0) {
+        fail_request(app, id, name, err);
     }
+}
 
-    }
+// Lua scripts are looked up in each --script-dir, in the order given, then
+// in $XDG_CONFIG_HOME/eluxi-player/scripts and the same under each of
+// $XDG_CONFIG_DIRS. A script in an earlier directory hides one with the same
+// file name in a later directory.
+static gchar **opt_script_dirs = NULL;
 
-     // Update playlist highlighting
-     if (app->current_playlist_item) {
-        GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-        gtk_style_context_remove_class(context, "playing-video");
+static GPtrArray *script_search_dirs(void) {
+    GPtrArray *dirs = g_ptr_array_new_with_free_func(g_free);
+    for (gchar **dir = opt_script_dirs; dir && *dir; ++dir) {
+        g_ptr_array_add(dirs, g_strdup(*dir));
     }
-
-    // Find the corresponding menu item and set its color
-    GList *children = gtk_container_get_children(GTK_CONTAINER(app->playlist_box));
-    for (GList *child = children; child != NULL; child = child->next) {
-        if (GTK_IS_MENU_ITEM(child->data)) {
-            const char *item_label = gtk_menu_item_get_label(GTK_MENU_ITEM(child->data));
-            if (item_label && strcmp(item_label, next_file) == 0) {
-                app->current_playlist_item = GTK_WIDGET(child->data);
-                GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-                gtk_style_context_add_class(context, "playing-video");
-                break;
-            }
-        }
+    g_ptr_array_add(dirs, g_build_filename(g_get_user_config_dir(), "eluxi-player", "scripts", NULL));
+    for (const gchar *const *dir = g_get_system_config_dirs(); *dir; ++dir) {
+        g_ptr_array_add(dirs, g_build_filename(*dir, "eluxi-player", "scripts", NULL));
     }
+    return dirs;
+}
 
-    
-
-    return FALSE; // Only run once
+static gint compare_script_names(gconstpointer a, gconstpointer b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
 }
 
+// One round of load-script commands, timed as mpv answers them
+typedef struct {
+    guint pending;
+    guint failed;
+    guint count;
+    gint64 started;
+    gint64 last_reply;   // When the previous script's reply came in
+} ScriptLoadBatch;
 
-void cleanup_cached_menus() {
-    if (cached_vmenu) {
-        gtk_widget_destroy(cached_vmenu);
-        cached_vmenu = NULL;
+typedef struct {
+    ScriptLoadBatch *batch;
+    char *path;
+} ScriptLoad;
+
+// mpv runs the commands one after another, so a script's own load time is
+// the time from the previous reply (or the first send) to its own
+static void on_script_loaded(AppData *app, const MpvReply *reply, gpointer user_data) {
+    ScriptLoad *load = (ScriptLoad *)user_data;
+    ScriptLoadBatch *batch = load->batch;
+    double ms = (reply->received - batch->last_reply) / 1000.0;
+    batch->last_reply = MAX(batch->last_reply, reply->received);
+    if (reply->error < 0) {
+        fprintf(stderr, "Failed to load Lua script: %s (MPV Error: %s)\n", load->path, mpv_error_string(reply->error));
+        batch->failed++;
+    } else {
+        g_debug("Script loaded in %.2f ms: %s", ms, load->path);
     }
-    if (cached_amenu) {
-        gtk_widget_destroy(cached_amenu);
-        cached_amenu = NULL;
+    if (--batch->pending == 0) {
+        g_debug("Scripts: %u of %u loaded in %.2f ms", batch->count - batch->failed, batch->count,
+                (batch->last_reply - batch->started) / 1000.0);
+        g_free(batch);
     }
+    g_free(load->path);
+    g_free(load);
 }
 
-// Function to handle MPV events
-static void handle_mpv_events(void *data) {
-    AppData *app = (AppData *)data;
-    mpv_handle *mpv = app->mpv;
-
-    while (1) {
-        mpv_event *event = mpv_wait_event(mpv, 0);
-        if (event == NULL) {
-            break;
+// Queue a load-script for every *.lua in the script directories, in name
+// order within each directory. mpv loads them while startup goes on; the
+// replies report how long each one took.
+static void load_lua_scripts(AppData *app) {
+    GPtrArray *dirs = script_search_dirs();
+    guint explicit_dirs = opt_script_dirs ? g_strv_length(opt_script_dirs) : 0;
+    GHashTable *seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL); // Names already taken
+    GPtrArray *paths = g_ptr_array_new_with_free_func(g_free);
+    for (guint i = 0; i < dirs->len; ++i) {
+        const char *dir_path = g_ptr_array_index(dirs, i);
+        DIR *dir = opendir(dir_path);
+        if (!dir) {
+            if (i < explicit_dirs || errno != ENOENT) { // The XDG ones needn't exist
+                fprintf(stderr, "Could not open script directory %s: %s\n", dir_path, strerror(errno));
+            }
+            continue;
         }
-
-        switch (event->event_id) {
-            case MPV_EVENT_NONE:
-                break;
-            case MPV_EVENT_SHUTDOWN:
-                printf("MPV: Shutdown event received.\n");
-                g_idle_add((GSourceFunc)gtk_main_quit, NULL);
-                return;
-                case MPV_EVENT_FILE_LOADED:
-                if (app->waiting_for_manual_load) {
-                    printf("MPV: Manual load completed.\n");
-                    app->waiting_for_manual_load = FALSE;
-                    app->manual_selection = FALSE;  // Clear manual mode after successful load
-                }
-                break;
-            case MPV_EVENT_PLAYBACK_RESTART:
-                printf("MPV: Playback started.\n");
-                break;
-            case MPV_EVENT_PROPERTY_CHANGE: {
-                mpv_event_property *prop = (mpv_event_property *)event->data;
-                if (strcmp(prop->name, "pause") == 0) {
-                    if (prop->data) {
-                        g_idle_add((GSourceFunc)print_pause_state, prop->data);
-                    }
-                } else if (strcmp(prop->name, "duration") == 0) {
-                    if (prop->data) {
-                        g_idle_add((GSourceFunc)print_duration, prop->data);
-                    }
-                } else if (strcmp(prop->name, "volume") == 0) {
-                    // Update volume slider when volume changes
-                    if (prop->data) {
-                         g_idle_add((GSourceFunc)update_volume_slider, app);
-                    }
-                } 
-                break;
+        GPtrArray *names = g_ptr_array_new();
+        struct dirent *ent;
+        while ((ent = readdir(dir)) != NULL) {
+            if (ent->d_name[0] != '.' && g_str_has_suffix(ent->d_name, ".lua")) {
+                g_ptr_array_add(names, g_strdup(ent->d_name));
             }
-            case MPV_EVENT_END_FILE:
-            printf("MPV: End of file.\n");
-            if (app->manual_selection) {
-                printf("MPV: Manual selection detected. Skipping auto-play.\n");
-                app->manual_selection = FALSE;  // Reset it
+        }
+        closedir(dir);
+        g_ptr_array_sort(names, compare_script_names);
+        for (guint j = 0; j < names->len; ++j) {
+            char *name = g_ptr_array_index(names, j);
+            if (g_hash_table_contains(seen, name)) {
+                g_free(name);
             } else {
-                g_idle_add((GSourceFunc)play_next_in_queue, app);
+                g_ptr_array_add(paths, g_build_filename(dir_path, name, NULL));
+                g_hash_table_add(seen, name);
             }
-            cleanup_cached_menus();
-            break;
-            default:
-                printf("MPV: Unhandled event: %s\n", mpv_event_name(event->event_id));
         }
+        g_ptr_array_free(names, TRUE);
     }
-}
-
-// Correct helper function to find a property in an mpv_node_list
-static mpv_node* mpv_node_list_find_property(mpv_node_list *list, const char *key) {
-    if (!list || !key)
-        return NULL;
 
-    for (int i = 0; i < list->num; ++i) {
-        if (list->keys && list->keys[i] && strcmp(list->keys[i], key) == 0) {
-            return &list->values[i];
+    if (paths->len == 0) {
+        g_debug("Scripts: none found");
+    } else {
+        ScriptLoadBatch *batch = g_new0(ScriptLoadBatch, 1);
+        batch->count = batch->pending = paths->len;
+        batch->started = batch->last_reply = g_get_monotonic_time();
+        for (guint i = 0; i < paths->len; ++i) {
+            ScriptLoad *load = g_new0(ScriptLoad, 1);
+            load->batch = batch; // Freed with the last reply
+            load->path = g_strdup(g_ptr_array_index(paths, i));
+            async_command(app, (const char *[]){"load-script", load->path, NULL}, on_script_loaded, load);
         }
     }
-
-    return NULL;
+    g_hash_table_destroy(seen);
+    g_ptr_array_free(paths, TRUE);
+    g_ptr_array_free(dirs, TRUE);
 }
 
-// Function to load a file into MPV
-static void load_file_in_mpv(mpv_handle *mpv, const char *filename) {
-    if (mpv && filename) {
-        const char *cmd[] = {"loadfile", filename, NULL};
-        mpv_command(mpv, cmd);
+// Move the "now playing" highlight to the row of the given entry. Both rows
+// are reached through the entries' own iters, so this is O(1) per change.
+static void highlight_playlist_item(AppData *app, PlaylistEntry *entry) {
+    PlaylistEntry *previous = playlist_get(playlist_index_of(app->playing_entry_id));
+    if (previous) {
+        gtk_list_store_set(app->playlist_store, &previous->row, PLAYLIST_COL_PLAYING, FALSE, -1);
+    }
+    app->playing_entry_id = 0;
+    if (entry) {
+        gtk_list_store_set(app->playlist_store, &entry->row, PLAYLIST_COL_PLAYING, TRUE, -1);
+        app->playing_entry_id = entry->id;
     }
 }
 
-// Function to toggle pause (GTK callback)
-static void on_play_pause_clicked(GtkWidget *button, AppData *app) {
-    int pause = 0;
-    if (!app->mpv) {
-        fprintf(stderr, "MPV is not initialized.\n");
+static gboolean playlist_file_write(const char *path, guint first, GError **error);
+
+static void mirror_playlist_to_mpv(AppData *app);
+static void mpv_playlist_send_appends(AppData *app);
+static void on_play_index_reply(AppData *app, const MpvReply *reply, gpointer user_data);
+
+// Temporary list file for loadlist. A new name each time: mpv may not have
+// read the last one yet.
+static char *mpv_list_file_path(void) {
+    static guint serial = 0;
+    char *name = g_strdup_printf("eluxi-player-%d-%u.m3u", (int)getpid(), serial++);
+    char *path = g_build_filename(g_get_user_runtime_dir(), name, NULL);
+    g_free(name);
+    return path;
+}
+
+// mpv has read the list mirror_playlist_to_mpv() wrote for it; only now do
+// its playlist indices mean ours, so this is where playback starts. If it
+// could not, play the current entry on its own. A mirror asked for
+// meanwhile goes out now, a list made stale by a new playlist is dropped.
+static void on_mirror_list_loaded(AppData *app, const MpvReply *reply, gpointer user_data) {
+    char *path = (char *)user_data;
+    g_unlink(path);
+    g_free(path);
+    app->mpv_list_in_flight = FALSE;
+    app->mpv_mirroring = FALSE;
+    gboolean stale = app->mpv_mirror_stale;
+    app->mpv_mirror_stale = FALSE;
+    if (app->mpv_mirror_wanted) {
+        mirror_playlist_to_mpv(app);
         return;
     }
-    if (mpv_get_property(app->mpv, "pause", MPV_FORMAT_FLAG, &pause) >= 0) {
-        pause = !pause;
-        mpv_set_property(app->mpv, "pause", MPV_FORMAT_FLAG, &pause);
-    } else {
-        fprintf(stderr, "Failed to get pause property.\n");
-    }
-
-    // Update button label
-    // Update button label
-    if (pause) {
-        // GtkWidget *old_image = gtk_button_get_image(GTK_BUTTON(app->play_button));
-        // if (old_image) {
-        //     gtk_widget_destroy(old_image);  // Free the old image
-        // }
-        GtkWidget *play_icon = gtk_image_new_from_icon_name("media-playback-start", GTK_ICON_SIZE_BUTTON);
-        gtk_button_set_image(GTK_BUTTON(app->play_button), play_icon);
-    } else {
-        // GtkWidget *old_image = gtk_button_get_image(GTK_BUTTON(app->play_button));
-        // if (old_image) {
-        //     gtk_widget_destroy(old_image);  // Free the old image
-        // }
-        GtkWidget *pause_icon = gtk_image_new_from_icon_name("media-playback-pause", GTK_ICON_SIZE_BUTTON);
-        gtk_button_set_image(GTK_BUTTON(app->play_button), pause_icon);
+    if (stale) {
+        return;
+    }
+    PlaylistEntry *entry = playlist_current_entry();
+    if (reply->error < 0) {
+        fprintf(stderr, "MPV: loadlist failed: %s\n", mpv_error_string(reply->error));
+        if (entry) {
+            async_command(app, (const char *[]){"loadfile", entry->path, NULL}, NULL, NULL);
+        }
+        return;
+    }
+    app->mpv_playlist_synced = TRUE;
+    app->mpv_loaded_length = app->mpv_sent_length;
+    if (entry) {
+        char index[16];
+        snprintf(index, sizeof(index), "%d", playlist.current);
+        async_command(app, (const char *[]){"playlist-play-index", index, NULL}, on_play_index_reply,
+                      GINT_TO_POINTER(playlist.current));
     }
+    mpv_playlist_send_appends(app); // Whatever was added while it loaded
 }
 
-// Function to stop playback (GTK callback)
-static void on_stop_clicked(GtkWidget *button, AppData *app) {
-    const char *cmd[] = {"stop", NULL};
-    mpv_command(app->mpv, cmd);
+// Hand the whole playlist to mpv's own playlist; on_mirror_list_loaded then
+// starts the current entry. mpv prefetches the following file and advances
+// by itself, so track changes need no round-trip through us. However long
+// the playlist, it goes over as one temporary M3U and a single loadlist.
+// mpv reads lists on a thread of its own, so commands sent after one may
+// overtake it: only one loadlist is in flight at a time, and nothing that
+// depends on mpv's indices is sent until it has replied.
+static void mirror_playlist_to_mpv(AppData *app) {
+    app->mpv_playlist_synced = FALSE;
+    if (app->mpv_list_in_flight) {
+        // A mirror of this very playlist already starts the current entry
+        if (!app->mpv_mirroring || app->mpv_mirror_stale) {
+            app->mpv_mirror_wanted = TRUE;
+        }
+        return;
+    }
+    app->mpv_mirror_wanted = FALSE;
+    PlaylistEntry *entry = playlist_current_entry();
+    if (!entry) {
+        return;
+    }
+    char *path = mpv_list_file_path();
+    async_command(app, (const char *[]){"stop", NULL}, NULL, NULL); // Also empties mpv's playlist
+    GError *error = NULL;
+    if (!playlist_file_write(path, 0, &error)) {
+        fprintf(stderr, "Playlist: cannot hand the list to mpv: %s\n", error->message);
+        g_error_free(error);
+        g_free(path);
+        async_command(app, (const char *[]){"loadfile", entry->path, NULL}, NULL, NULL);
+        return;
+    }
+    async_command(app, (const char *[]){"loadlist", path, "append", NULL}, on_mirror_list_loaded, path);
+    app->mpv_list_in_flight = TRUE;
+    app->mpv_mirroring = TRUE;
+    app->mpv_sent_length = playlist_length();
+    app->mpv_loaded_length = 0;
 }
 
-/*static gboolean on_playlist_item_clicked(GtkWidget *widget, GdkEventButton *event, gpointer user_data) {
-    AppData *app = (AppData *)user_data;
-    const char *filename = gtk_label_get_text(GTK_LABEL(widget));
-    load_file_in_mpv(app->mpv, filename);
-    return FALSE;
-}*/
-static void on_playlist_item_clicked(GtkWidget *button, gpointer user_data) {
-    AppData *app = (AppData *)user_data;
-    const char *filename = gtk_button_get_label(GTK_BUTTON(button));
-    app->manual_selection = TRUE;
-    app->waiting_for_manual_load = TRUE;
-    // Reset color of the previously playing item
-    if (app->current_playlist_item) {
-        GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-        gtk_style_context_remove_class(context, "playing-video");
-    }
-
-    // Find the corresponding GList element
-    GList *l;
-    for (l = video_queue; l != NULL; l = l->next) {
-        if (strcmp((char *)l->data, filename) == 0) {
-            current_video = l;
-            break;
-        }
+// mpv has read a list of appended entries. If it could not, its playlist is
+// now shorter than ours; the next jump mirrors the whole list again.
+static void on_append_list_loaded(AppData *app, const MpvReply *reply, gpointer user_data) {
+    char *path = (char *)user_data;
+    g_unlink(path);
+    g_free(path);
+    app->mpv_list_in_flight = FALSE;
+    if (app->mpv_mirror_wanted) {
+        mirror_playlist_to_mpv(app);
+        return;
+    }
+    if (reply->error < 0) {
+        fprintf(stderr, "MPV: loadlist failed: %s\n", mpv_error_string(reply->error));
+        app->mpv_playlist_synced = FALSE;
+        return;
     }
+    app->mpv_loaded_length = app->mpv_sent_length;
+    mpv_playlist_send_appends(app);
+}
 
-    app->current_playlist_item = button;
-    GtkStyleContext *context = gtk_widget_get_style_context(button);
-    gtk_style_context_add_class(context, "playing-video");
+// Send the entries appended to our playlist since mpv's copy was last
+// extended, all of them as one temporary list. While a loadlist is still
+// loading they wait for its reply, so they land after it and in order.
+static void mpv_playlist_send_appends(AppData *app) {
+    if (!app->gapless || !app->mpv_playlist_synced || app->mpv_list_in_flight ||
+        app->mpv_sent_length >= playlist_length()) {
+        return;
+    }
+    char *path = mpv_list_file_path();
+    GError *error = NULL;
+    if (!playlist_file_write(path, app->mpv_sent_length, &error)) {
+        fprintf(stderr, "Playlist: cannot hand new entries to mpv: %s\n", error->message);
+        g_error_free(error);
+        g_free(path);
+        app->mpv_playlist_synced = FALSE;
+        return;
+    }
+    async_command(app, (const char *[]){"loadlist", path, "append", NULL}, on_append_list_loaded, path);
+    app->mpv_list_in_flight = TRUE;
+    app->mpv_sent_length = playlist_length();
+}
 
-    load_file_in_mpv(app->mpv, filename);
+// Keep mpv's copy in step with the entry at index leaving ours. Entries mpv
+// has loaded are removed there too; ones it has not been sent simply won't
+// be. One that is on its way can't be taken back, so the list goes over
+// again once it has arrived.
+static void mpv_playlist_remove(AppData *app, gint index) {
+    if (!app->gapless || (guint)index >= app->mpv_sent_length) {
+        return;
+    }
+    if (app->mpv_playlist_synced && (guint)index < app->mpv_loaded_length) {
+        char mpv_index[16];
+        snprintf(mpv_index, sizeof(mpv_index), "%d", index);
+        async_command(app, (const char *[]){"playlist-remove", mpv_index, NULL}, NULL, NULL);
+        app->mpv_loaded_length--;
+        app->mpv_sent_length--;
+    } else if (app->mpv_list_in_flight && !app->mpv_mirror_stale) {
+        app->mpv_mirror_wanted = TRUE;
+        app->mpv_playlist_synced = FALSE;
+    }
 }
 
-static void on_playlist_menuitem_clicked(GtkWidget *menu_item, gpointer user_data) {
-    AppData *app = (AppData *)user_data;
-    const char *filename = gtk_menu_item_get_label(GTK_MENU_ITEM(menu_item)); // Get label from MenuItem
-    app->manual_selection = TRUE;
-    app->waiting_for_manual_load = TRUE;
+// Our playlist was cleared or replaced, or mpv's emptied by "stop". A mirror
+// still loading no longer matches either, so its reply must not start it.
+static void mpv_playlist_forget(AppData *app) {
+    app->mpv_playlist_synced = FALSE;
+    app->mpv_mirror_stale = app->mpv_mirroring;
+    app->mpv_mirror_wanted = FALSE;
+}
 
-    // Reset color of the previously playing item
-    if (app->current_playlist_item) {
-        GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-        gtk_style_context_remove_class(context, "playing-video");
+// playlist-play-index failed (mpv's playlist went away): send it ours again
+static void on_play_index_reply(AppData *app, const MpvReply *reply, gpointer user_data) {
+    if (reply->error < 0 && app->mpv_playlist_synced && playlist.current == GPOINTER_TO_INT(user_data)) {
+        mirror_playlist_to_mpv(app);
     }
+}
 
-    // Find the corresponding GList element
-    GList *l;
-    for (l = video_queue; l != NULL; l = l->next) {
-        if (strcmp((char *)l->data, filename) == 0) {
-            current_video = l;
-            break;
-        }
+// Load the current playlist entry, or stop if the cursor ran off the end
+static void play_current_entry(AppData *app) {
+    PlaylistEntry *entry = playlist_current_entry();
+    if (!entry) {
+        printf("End of queue.\n");
+        async_command(app, (const char *[]){"stop", NULL}, NULL, NULL);
+        highlight_playlist_item(app, NULL);
+        return;
     }
 
-    //Find the corresponding menu item and set its color
-    GList *children = gtk_container_get_children(GTK_CONTAINER(app->playlist_box));
-    for (GList *child = children; child != NULL; child = child->next) {
-        if (GTK_IS_MENU_ITEM(child->data)) {
-            const char *item_label = gtk_menu_item_get_label(GTK_MENU_ITEM(child->data));
-            if (item_label && strcmp(item_label, filename) == 0) {
-                app->current_playlist_item = GTK_WIDGET(child->data);
-                GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-                gtk_style_context_add_class(context, "playing-video");
-                break;
-            }
+    printf("Now playing next file: %s\n", entry->path);
+    highlight_playlist_item(app, entry);
+    if (app->gapless) {
+        char index[16];
+        snprintf(index, sizeof(index), "%d", playlist.current);
+        const char *cmd[] = {"playlist-play-index", index, NULL};
+        if (app->mpv_playlist_synced && (guint)playlist.current < app->mpv_loaded_length) {
+            async_command(app, cmd, on_play_index_reply, GINT_TO_POINTER(playlist.current));
+        } else {
+            mirror_playlist_to_mpv(app); // Plays the current entry once mpv has the list
         }
+        return;
     }
-
-    load_file_in_mpv(app->mpv, filename);
+    const char *cmd[] = {"loadfile", entry->path, NULL};
+    async_command(app, cmd, NULL, NULL);
 }
 
-// Helper function to toggle visibility
-void toggle_playlist_visibility(GtkWidget *playlist_box) {
-    gboolean is_visible = gtk_widget_get_visible(playlist_box);
-    gtk_widget_set_visible(playlist_box, !is_visible);  // Toggle the visibility
+// Jump to the entry at index (playlist click, start of a new queue)
+static void play_playlist_index(AppData *app, gint index) {
+    if (playlist_set_current(index)) {
+        play_current_entry(app);
+    }
 }
 
-void update_playlist(GtkWidget *playlist_box, GList *queue, AppData *app) {
-    // IMPORTANT: Reset current_playlist_item before destroying buttons
-    app->current_playlist_item = NULL;
+// Function to play the next file in the queue
+static gboolean play_next_in_queue(AppData *app) {
+    if (!app || playlist_length() == 0) {
+        printf("Queue empty. Nothing to play.\n");
+        return FALSE; // No more videos
+    }
 
-    GList *children = gtk_container_get_children(GTK_CONTAINER(playlist_box));
-    for (GList *l = children; l != NULL; l = l->next) {
-        gtk_widget_destroy(GTK_WIDGET(l->data));
+    if (!playlist_current_entry()) {
+        printf("No current video selected.\n");
+        return FALSE;
     }
 
-    for (GList *l = queue; l != NULL; l = l->next) {
-        GtkWidget *button = gtk_button_new_with_label((char *)l->data); // Create a button with the filename as label
-        g_signal_connect_data(button, "clicked", // Connect "clicked" signal, not "button-press-event"
-            G_CALLBACK(on_playlist_item_clicked),
-            app, NULL, 0);
-        gtk_box_pack_start(GTK_BOX(playlist_box), button, FALSE, FALSE, 5);
+    if (app->gapless && app->mpv_playlist_synced) {
+        // mpv owns the advance; playlist-pos brings the cursor along
+        async_command(app, (const char *[]){"playlist-next", NULL}, NULL, NULL);
+        return FALSE;
     }
-    gtk_widget_show_all(playlist_box);
-    toggle_playlist_visibility(playlist_box);
+
+    // Advance to the next video in the queue
+    playlist_advance(1);
+    play_current_entry(app);
+    return FALSE; // Only run once
+}
+
+// Function to start the queue from its first file
+static gboolean play_next_in_queue_false(AppData *app) {
+    play_playlist_index(app, 0);
+    return FALSE; // Only run once
 }
 
-void update_playlist_menu(AppData *app, GList *queue) {
-    // Destroy any existing menu items (if necessary - handle cases where you update)
-    GList *children = gtk_container_get_children(GTK_CONTAINER(app->playlist_box));
-    for (GList *l = children; l != NULL; l = l->next) {
-        gtk_widget_destroy(GTK_WIDGET(l->data));
+// mpv moved through its playlist on its own: follow it with our cursor
+static void follow_mpv_playlist_pos(AppData *app, gint64 pos) {
+    if (!app->gapless || !app->mpv_playlist_synced || pos == playlist.current) {
+        return;
     }
+    highlight_playlist_item(app, playlist_set_current((gint)pos));
+}
 
-    // Repurpose playlist_box as the menu
-    GtkWidget *menu = GTK_WIDGET(app->playlist_box); // Reuse the box as the menu
 
-    for (GList *l = queue; l != NULL; l = l->next) {
-        GtkWidget *menu_item = gtk_menu_item_new_with_label((char *)l->data);
-        g_signal_connect(menu_item, "activate", G_CALLBACK(on_playlist_menuitem_clicked), app);
-        gtk_menu_shell_append(GTK_MENU_SHELL(menu), menu_item);
-        gtk_widget_show(menu_item);
-    }
+// Properties we ask mpv to push to us. The enum value is the reply_userdata
+// passed to mpv_observe_property, so a change event indexes the table directly.
+typedef enum {
+    OBSERVE_TIME_POS = 1,
+    OBSERVE_DURATION,
+    OBSERVE_PAUSE,
+    OBSERVE_VOLUME,
+    OBSERVE_TRACK_LIST,
+    OBSERVE_PATH,
+    OBSERVE_EOF_REACHED,
+    OBSERVE_PLAYLIST_POS,
+    OBSERVE_VIDEO_WIDTH,
+    OBSERVE_VIDEO_HEIGHT,
+    OBSERVE_AID,
+    OBSERVE_SID,
+    OBSERVE_VID,
+    OBSERVE_COUNT
+} ObservedProperty;
 
-    
+typedef struct {
+    const char *name;
+    mpv_format format;
+    guint dirty; // Widgets that care about this property
+} PropertyObserver;
+
+static const PropertyObserver property_observers[OBSERVE_COUNT] = {
+    [OBSERVE_TIME_POS]    = {"time-pos",    MPV_FORMAT_DOUBLE, UI_DIRTY_POSITION},
+    [OBSERVE_DURATION]    = {"duration",    MPV_FORMAT_DOUBLE, UI_DIRTY_DURATION},
+    [OBSERVE_PAUSE]       = {"pause",       MPV_FORMAT_FLAG,   UI_DIRTY_PAUSE | UI_DIRTY_PLAYING},
+    [OBSERVE_VOLUME]      = {"volume",      MPV_FORMAT_DOUBLE, UI_DIRTY_VOLUME},
+    [OBSERVE_TRACK_LIST]  = {"track-list",  MPV_FORMAT_NODE,   UI_DIRTY_TRACKS},
+    [OBSERVE_PATH]        = {"path",        MPV_FORMAT_STRING, UI_DIRTY_PATH | UI_DIRTY_PLAYING},
+    [OBSERVE_EOF_REACHED] = {"eof-reached", MPV_FORMAT_FLAG,   UI_DIRTY_PAUSE},
+    [OBSERVE_PLAYLIST_POS] = {"playlist-pos", MPV_FORMAT_INT64, UI_DIRTY_PLAYLIST},
+    [OBSERVE_VIDEO_WIDTH]  = {"dwidth",       MPV_FORMAT_INT64, 0}, // Read by render_thread
+    [OBSERVE_VIDEO_HEIGHT] = {"dheight",      MPV_FORMAT_INT64, 0},
+    [OBSERVE_AID]          = {"aid",          MPV_FORMAT_STRING, 0}, // Saved with the session
+    [OBSERVE_SID]          = {"sid",          MPV_FORMAT_STRING, 0},
+    [OBSERVE_VID]          = {"vid",          MPV_FORMAT_STRING, 0},
+};
+
+static void register_property_observers(mpv_handle *mpv) {
+    for (int id = 1; id < OBSERVE_COUNT; ++id) {
+        const PropertyObserver *obs = &property_observers[id];
+        int err = mpv_observe_property(mpv, id, obs->name, obs->format);
+        if (err < 0) {
+            fprintf(stderr, "Failed to observe %s (MPV Error: %s)\n", obs->name, mpv_error_string(err));
+        }
+    }
 }
 
-static void on_playlist_button_clicked(GtkWidget *button, AppData *app_data) {
-    // Reuse playlist_box as the menu
-    GtkWidget *menu = GTK_WIDGET(app_data->playlist_box);
+static gboolean flush_ui_changes(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data);
 
-    //If the menu hasn't been created, create it
-    if (!GTK_IS_MENU(menu)) {
-        menu = gtk_menu_new();
-        app_data->playlist_box = menu;
-        update_playlist_menu(app_data, video_queue);
+// Runs on the GTK thread. Installs the frame-clock callback that applies the
+// pending changes, so widgets are touched at most once per displayed frame.
+static gboolean schedule_ui_flush(gpointer data) {
+    AppData *app = (AppData *)data;
+    if (app->ui_tick_id == 0) {
+        app->ui_tick_id = gtk_widget_add_tick_callback(app->window, flush_ui_changes, app, NULL);
     }
-    
-    gtk_menu_popup_at_widget(GTK_MENU(menu), button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
+    return G_SOURCE_REMOVE;
 }
 
+static gboolean apply_state_changes(gpointer data);
 
+// Called from mpv_thread. Only the first change after a flush costs a wakeup
+// of the GTK main loop; later ones just accumulate bits. State changes go
+// to their own idle, widget changes wait for the next frame.
+static void mark_ui_dirty(AppData *app, guint bits) {
+    guint state = bits & UI_STATE_BITS;
+    guint widgets = bits & ~UI_STATE_BITS;
+    if (state != 0 && g_atomic_int_or(&app->state_dirty, state) == 0) {
+        g_idle_add(apply_state_changes, app);
+    }
+    if (widgets != 0 && g_atomic_int_or(&app->ui_dirty, widgets) == 0) {
+        g_idle_add(schedule_ui_flush, app);
+    }
+}
 
+// Seqlock writer side, only ever called from mpv_thread
+static void player_state_write_begin(PlayerState *st) {
+    unsigned seq = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    atomic_store_explicit(&st->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+}
 
-static void on_file_open_clicked(GtkWidget *button, AppData *app) {
+static void player_state_write_end(PlayerState *st) {
+    unsigned seq = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    atomic_store_explicit(&st->seq, seq + 1, memory_order_release);
+}
+
+// Take a consistent copy of the state without locking or allocating
+static void player_state_read(PlayerState *st, PlayerSnapshot *out) {
+    unsigned begin, end;
+    do {
+        begin = atomic_load_explicit(&st->seq, memory_order_acquire);
+        if (begin & 1) {
+            end = begin + 1; // Writer is mid-update, try again
+            continue;
+        }
+        memcpy(out, &st->data, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        end = atomic_load_explicit(&st->seq, memory_order_relaxed);
+    } while (begin != end);
+}
+
+static void track_model_update(const mpv_node *node, int counts[TRACK_TYPE_COUNT]);
+
+// Keep the playing file's resume point current (event thread). Only values
+// mpv reports as available are taken, so a time-pos that goes away while the
+// file unloads never replaces the last real one. The on_unload hook closes
+// the record and hands it over; late events for that file are ignored until
+// the path changes.
+static void watched_update(AppData *app, ObservedProperty id, gboolean have) {
+    const PlayerSnapshot *now = &app->state.data; // Only this thread writes it
+    if (id == OBSERVE_PATH) {
+        app->watched_closed = FALSE;
+    }
+    if (!have || app->watched_closed || !now->path[0]) {
+        return;
+    }
+    g_mutex_lock(&app->watched_lock);
+    if (strcmp(app->watched.path, now->path) != 0) {
+        app->watched = *now; // Tracks, duration and so on as they stand
+        app->watched.time_pos = -1;
+    }
+    switch (id) {
+        case OBSERVE_TIME_POS:
+            app->watched.time_pos = now->time_pos;
+            break;
+        case OBSERVE_DURATION:
+            app->watched.duration = now->duration;
+            break;
+        case OBSERVE_EOF_REACHED:
+            app->watched.eof_reached = now->eof_reached;
+            break;
+        case OBSERVE_AID:
+            g_strlcpy(app->watched.aid, now->aid, sizeof(app->watched.aid));
+            break;
+        case OBSERVE_SID:
+            g_strlcpy(app->watched.sid, now->sid, sizeof(app->watched.sid));
+            break;
+        case OBSERVE_VID:
+            g_strlcpy(app->watched.vid, now->vid, sizeof(app->watched.vid));
+            break;
+        default:
+            break;
+    }
+    g_mutex_unlock(&app->watched_lock);
+}
+
+// A copy of the playing file's resume point, for any thread
+static void watched_read(AppData *app, PlayerSnapshot *out) {
+    g_mutex_lock(&app->watched_lock);
+    *out = app->watched;
+    g_mutex_unlock(&app->watched_lock);
+}
+
+// Copy a property change out of the mpv event before the buffer is reused
+static void store_observed_property(AppData *app, uint64_t id, mpv_event_property *prop) {
+    if (id == 0 || id >= OBSERVE_COUNT) {
+        return; // Not one of ours
+    }
+    // MPV_FORMAT_NONE means the property became unavailable (e.g. no file)
+    gboolean have = prop->format == property_observers[id].format && prop->data;
+    PlayerState *st = &app->state;
+    int track_counts[TRACK_TYPE_COUNT] = {0};
+    if (id == OBSERVE_TRACK_LIST) {
+        // Parsed before the write section so snapshot readers never wait on it
+        track_model_update(have ? (mpv_node *)prop->data : NULL, track_counts);
+    }
+
+    player_state_write_begin(st);
+    switch ((ObservedProperty)id) {
+        case OBSERVE_TIME_POS:
+            st->data.time_pos = have ? *(double *)prop->data : 0;
+            break;
+        case OBSERVE_DURATION:
+            st->data.duration = have ? *(double *)prop->data : 0;
+            break;
+        case OBSERVE_PAUSE:
+            st->data.pause = have ? *(int *)prop->data : FALSE;
+            break;
+        case OBSERVE_VOLUME:
+            if (have) {
+                st->data.volume = *(double *)prop->data;
+            }
+            break;
+        case OBSERVE_TRACK_LIST:
+            st->data.video_tracks = track_counts[TRACK_VIDEO];
+            st->data.audio_tracks = track_counts[TRACK_AUDIO];
+            st->data.sub_tracks = track_counts[TRACK_SUB];
+            break;
+        case OBSERVE_PATH:
+            g_strlcpy(st->data.path, have ? *(char **)prop->data : "", sizeof(st->data.path));
+            break;
+        case OBSERVE_EOF_REACHED:
+            st->data.eof_reached = have ? *(int *)prop->data : FALSE;
+            break;
+        case OBSERVE_PLAYLIST_POS:
+            st->data.playlist_pos = have ? *(int64_t *)prop->data : -1;
+            break;
+        case OBSERVE_VIDEO_WIDTH:
+            st->data.video_width = have ? (int)*(int64_t *)prop->data : 0;
+            break;
+        case OBSERVE_VIDEO_HEIGHT:
+            st->data.video_height = have ? (int)*(int64_t *)prop->data : 0;
+            break;
+        case OBSERVE_AID:
+            g_strlcpy(st->data.aid, have ? *(char **)prop->data : "", sizeof(st->data.aid));
+            break;
+        case OBSERVE_SID:
+            g_strlcpy(st->data.sid, have ? *(char **)prop->data : "", sizeof(st->data.sid));
+            break;
+        case OBSERVE_VID:
+            g_strlcpy(st->data.vid, have ? *(char **)prop->data : "", sizeof(st->data.vid));
+            break;
+        default:
+            break;
+    }
+    player_state_write_end(st);
+    watched_update(app, (ObservedProperty)id, have);
+
+    mark_ui_dirty(app, property_observers[id].dirty);
+}
+
+// Watch-later store: per-file resume points, keyed by a 64-bit hash of the
+// path. The file is an append-only log of fixed-size records after a short
+// header; the newest record for a key wins. Everything is read into a hash
+// index at startup, and the log is rewritten with only the live records
+// once superseded ones make up most of it.
+#define WATCH_LATER_MAGIC "ELXW"
+#define WATCH_LATER_VERSION 1
+#define WATCH_LATER_BYTE_ORDER 0x01020304u
+#define WATCH_MIN_POSITION 10.0       // Closer to the start than this is not worth resuming
+#define WATCH_COMPLETE_FRACTION 0.95  // Past this much of the duration counts as watched
+#define WATCH_COMPACT_MIN_RECORDS 1024
+
+enum {
+    WATCH_COMPLETED = 1 << 0
+};
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 byte_order;
+    guint32 record_size;
+} WatchLaterHeader;
+
+typedef struct {
+    guint64 key;         // watch_later_key() of the path
+    double position;
+    double duration;
+    guint32 flags;       // WATCH_* bits
+    char aid[8], sid[8], vid[8];
+    guint32 check;       // Over the bytes before it, so a torn last record is dropped
+} WatchRecord;
+
+typedef struct {
+    GMutex lock;         // Guards index; the on_load hook reads it on the event thread
+    GHashTable *index;   // &WatchRecord.key -> WatchRecord (the newest for that key)
+    char *file;
+    int fd;              // Log opened for appending (GTK thread only), -1 if unusable
+    guint log_records;   // Records in the log, superseded ones included
+} WatchLater;
+
+static WatchLater watch_later = {.fd = -1};
+
+// FNV-1a; also used for the record check
+static guint64 fnv1a_64(const void *data, size_t len) {
+    const guint8 *p = data;
+    guint64 hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ p[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static guint64 watch_later_key(const char *path) {
+    return fnv1a_64(path, strlen(path));
+}
+
+static guint32 watch_record_check(const WatchRecord *record) {
+    return (guint32)fnv1a_64(record, G_STRUCT_OFFSET(WatchRecord, check));
+}
+
+// Rewrite the log with one record per key (GTK thread)
+static void watch_later_compact(void) {
+    WatchLaterHeader header = {WATCH_LATER_MAGIC, WATCH_LATER_VERSION, WATCH_LATER_BYTE_ORDER, sizeof(WatchRecord)};
+    g_mutex_lock(&watch_later.lock);
+    guint live = g_hash_table_size(watch_later.index);
+    GByteArray *out = g_byte_array_sized_new(sizeof(header) + live * sizeof(WatchRecord));
+    g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init(&iter, watch_later.index);
+    while (g_hash_table_iter_next(&iter, NULL, &value)) {
+        g_byte_array_append(out, value, sizeof(WatchRecord));
+    }
+    g_mutex_unlock(&watch_later.lock);
+
+    GError *error = NULL;
+    if (watch_later.fd >= 0) {
+        close(watch_later.fd);
+        watch_later.fd = -1;
+    }
+    if (g_file_set_contents(watch_later.file, (const char *)out->data, out->len, &error)) {
+        watch_later.log_records = live;
+    } else {
+        fprintf(stderr, "Watch later: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_byte_array_free(out, TRUE);
+    watch_later.fd = open(watch_later.file, O_WRONLY | O_APPEND | O_CLOEXEC);
+}
+
+static gboolean watch_later_should_compact(void) {
+    return watch_later.log_records >= WATCH_COMPACT_MIN_RECORDS &&
+           watch_later.log_records > 2 * g_hash_table_size(watch_later.index);
+}
+
+static void watch_later_init(void) {
+    g_mutex_init(&watch_later.lock);
+    watch_later.index = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, g_free);
+    watch_later.file = g_build_filename(g_get_user_data_dir(), "eluxi-player", "watch-later.log", NULL);
+
+    gint64 start = g_get_monotonic_time();
+    gboolean rewrite = TRUE; // Missing, foreign or damaged logs are rewritten from the index
+    GMappedFile *mapped = g_mapped_file_new(watch_later.file, FALSE, NULL);
+    if (mapped) {
+        const char *data = g_mapped_file_get_contents(mapped);
+        gsize length = g_mapped_file_get_length(mapped);
+        WatchLaterHeader header;
+        if (length >= sizeof(header)) {
+            memcpy(&header, data, sizeof(header));
+        }
+        if (length >= sizeof(header) && memcmp(header.magic, WATCH_LATER_MAGIC, 4) == 0 &&
+            header.version == WATCH_LATER_VERSION && header.byte_order == WATCH_LATER_BYTE_ORDER &&
+            header.record_size == sizeof(WatchRecord)) {
+            gsize offset = sizeof(header);
+            for (; length - offset >= sizeof(WatchRecord); offset += sizeof(WatchRecord)) {
+                WatchRecord *record = g_new(WatchRecord, 1);
+                memcpy(record, data + offset, sizeof(*record));
+                if (record->check != watch_record_check(record)) {
+                    g_free(record);
+                    break;
+                }
+                g_hash_table_replace(watch_later.index, &record->key, record);
+                watch_later.log_records++;
+            }
+            rewrite = offset != length; // Drop a torn or corrupt tail
+        }
+        g_mapped_file_unref(mapped);
+    }
+    char *dir = g_path_get_dirname(watch_later.file);
+    g_mkdir_with_parents(dir, 0700);
+    g_free(dir);
+    if (rewrite || watch_later_should_compact()) {
+        watch_later_compact();
+    } else {
+        watch_later.fd = open(watch_later.file, O_WRONLY | O_APPEND | O_CLOEXEC);
+    }
+    g_debug("Watch later: %u files (%u log records) loaded in %.2f ms", g_hash_table_size(watch_later.index),
+            watch_later.log_records, (g_get_monotonic_time() - start) / 1000.0);
+}
+
+// Copy the record for path into out; any thread
+static gboolean watch_later_lookup(const char *path, WatchRecord *out) {
+    guint64 key = watch_later_key(path);
+    g_mutex_lock(&watch_later.lock);
+    WatchRecord *record = g_hash_table_lookup(watch_later.index, &key);
+    if (record) {
+        *out = *record;
+    }
+    g_mutex_unlock(&watch_later.lock);
+    return record != NULL;
+}
+
+// Record where playback of snap->path got to (GTK thread). Appends one
+// record, unless it would say the same as the one already there.
+static void watch_later_remember(const PlayerSnapshot *snap) {
+    if (!snap->path[0] || snap->time_pos < 0 || snap->duration <= 0 || !watch_later.index) {
+        return;
+    }
+    WatchRecord record;
+    memset(&record, 0, sizeof(record)); // No stray padding bytes in the log
+    record.key = watch_later_key(snap->path);
+    record.position = snap->time_pos;
+    record.duration = snap->duration;
+    if (snap->eof_reached || (snap->duration > 0 && snap->time_pos >= snap->duration * WATCH_COMPLETE_FRACTION)) {
+        record.flags |= WATCH_COMPLETED;
+    }
+    g_strlcpy(record.aid, snap->aid, sizeof(record.aid));
+    g_strlcpy(record.sid, snap->sid, sizeof(record.sid));
+    g_strlcpy(record.vid, snap->vid, sizeof(record.vid));
+    record.check = watch_record_check(&record);
+
+    g_mutex_lock(&watch_later.lock);
+    WatchRecord *old = g_hash_table_lookup(watch_later.index, &record.key);
+    gboolean same = old && ABS(old->position - record.position) < 1.0 && old->flags == record.flags &&
+                    strcmp(old->aid, record.aid) == 0 && strcmp(old->sid, record.sid) == 0 &&
+                    strcmp(old->vid, record.vid) == 0;
+    if (!same) {
+        WatchRecord *copy = g_new(WatchRecord, 1);
+        *copy = record;
+        g_hash_table_replace(watch_later.index, &copy->key, copy);
+    }
+    g_mutex_unlock(&watch_later.lock);
+    if (same) {
+        return;
+    }
+    if (watch_later.fd >= 0 && write(watch_later.fd, &record, sizeof(record)) == (ssize_t)sizeof(record)) {
+        watch_later.log_records++;
+    } else if (watch_later.fd >= 0) {
+        watch_later_compact(); // A short write would misalign every later record
+        return;
+    }
+    if (watch_later_should_compact()) {
+        watch_later_compact();
+    }
+}
+
+static void watch_later_shutdown(void) {
+    if (watch_later_should_compact()) {
+        watch_later_compact();
+    }
+    if (watch_later.fd >= 0) {
+        close(watch_later.fd);
+    }
+    g_hash_table_destroy(watch_later.index);
+    g_free(watch_later.file);
+    g_mutex_clear(&watch_later.lock);
+}
+
+// Subtitle sidecars: subtitle files next to a video that share its name,
+// optionally followed by a language tag ("Movie.srt", "Movie.en.srt",
+// "Movie.pt-BR.ass"). Each directory is listed once, on a worker,
+// when a file in it is about to play, and the listing is kept until the
+// directory's mtime changes. The on_preloaded hook then only matches names
+// in memory and sends an async sub-add for each match; the hook continues
+// from the last reply, so the tracks exist before mpv selects any. A
+// directory not listed yet is listed on the worker, never in the hook.
+#define SIDECAR_MAX_DIRS 256 // Listings kept; past this the least recently used goes
+
+typedef struct {
+    gint64 mtime;        // Of the directory when it was listed
+    gint64 used;         // Monotonic time of the last lookup
+    GPtrArray *names;    // Subtitle file names in it
+} SidecarDir;
+
+typedef struct {
+    GMutex lock;         // Guards dirs; the worker and the event thread both use it
+    GHashTable *dirs;    // Directory path -> SidecarDir
+    GThreadPool *pool;   // Lists directories ahead of playback
+} SidecarIndex;
+
+static SidecarIndex sidecars;
+
+static const char *const subtitle_extensions[] = {".srt", ".ass", ".ssa", ".vtt", ".sup", ".idx"};
+
+static gboolean is_subtitle_file(const char *name) {
+    const char *dot = strrchr(name, '.');
+    for (guint i = 0; dot && i < G_N_ELEMENTS(subtitle_extensions); ++i) {
+        if (g_ascii_strcasecmp(dot, subtitle_extensions[i]) == 0) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static void sidecar_dir_free(SidecarDir *cached) {
+    g_ptr_array_unref(cached->names);
+    g_free(cached);
+}
+
+// Drop the least recently used listing. Called with sidecars.lock held.
+static void sidecar_evict_one(void) {
+    GHashTableIter iter;
+    gpointer key, value;
+    gpointer oldest = NULL;
+    gint64 oldest_used = G_MAXINT64;
+    g_hash_table_iter_init(&iter, sidecars.dirs);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        SidecarDir *cached = (SidecarDir *)value;
+        if (cached->used < oldest_used) {
+            oldest_used = cached->used;
+            oldest = key;
+        }
+    }
+    if (oldest) {
+        g_hash_table_remove(sidecars.dirs, oldest);
+    }
+}
+
+// The subtitle files in dir (NULL if it can't be read); g_ptr_array_unref it.
+// Served from the cache unless the directory changed since it was listed;
+// otherwise NULL as well, unless list is set.
+static GPtrArray *sidecar_dir_names(const char *dir, gboolean list) {
+    GStatBuf st;
+    if (g_stat(dir, &st) != 0) {
+        return NULL;
+    }
+    g_mutex_lock(&sidecars.lock);
+    SidecarDir *cached = g_hash_table_lookup(sidecars.dirs, dir);
+    GPtrArray *names = NULL;
+    if (cached && cached->mtime == (gint64)st.st_mtime) {
+        cached->used = g_get_monotonic_time();
+        names = g_ptr_array_ref(cached->names);
+    }
+    g_mutex_unlock(&sidecars.lock);
+    if (names || !list) {
+        return names;
+    }
+
+    names = g_ptr_array_new_with_free_func(g_free);
+    DIR *stream = opendir(dir);
+    if (stream) {
+        struct dirent *ent;
+        while ((ent = readdir(stream)) != NULL) {
+            if (is_subtitle_file(ent->d_name)) {
+                g_ptr_array_add(names, g_strdup(ent->d_name));
+            }
+        }
+        closedir(stream);
+    }
+    cached = g_new(SidecarDir, 1);
+    cached->mtime = st.st_mtime;
+    cached->used = g_get_monotonic_time();
+    cached->names = g_ptr_array_ref(names);
+    g_mutex_lock(&sidecars.lock);
+    if (g_hash_table_size(sidecars.dirs) >= SIDECAR_MAX_DIRS && !g_hash_table_contains(sidecars.dirs, dir)) {
+        sidecar_evict_one();
+    }
+    g_hash_table_replace(sidecars.dirs, g_strdup(dir), cached);
+    g_mutex_unlock(&sidecars.lock);
+    return names;
+}
+
+// An on_preloaded hook waiting for sidecars. Every sub-add in flight holds
+// a reference, and so does whoever is still sending them; the last one out
+// continues the hook.
+typedef struct {
+    AppData *app;
+    char *path;          // Of the file being opened
+    uint64_t hook_id;
+    gint refs;
+    gint attached;
+} SidecarAttach;
+
+// Work for the sidecar pool: list dir, then attach if this is a hook's
+typedef struct {
+    char *dir;
+    SidecarAttach *attach; // NULL for a prefetch
+} SidecarJob;
+
+static void sidecar_attach_send(SidecarAttach *attach, GPtrArray *names);
+
+static void sidecar_worker(gpointer data, gpointer user_data) {
+    SidecarJob *job = (SidecarJob *)data;
+    GPtrArray *names = sidecar_dir_names(job->dir, TRUE);
+    if (job->attach) {
+        sidecar_attach_send(job->attach, names);
+    }
+    if (names) {
+        g_ptr_array_unref(names);
+    }
+    g_free(job->dir);
+    g_free(job);
+}
+
+static void sidecar_push(char *dir, SidecarAttach *attach) {
+    SidecarJob *job = g_new(SidecarJob, 1);
+    job->dir = dir;
+    job->attach = attach;
+    g_thread_pool_push(sidecars.pool, job, NULL);
+}
+
+static void sidecar_init(void) {
+    g_mutex_init(&sidecars.lock);
+    sidecars.dirs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify)sidecar_dir_free);
+    sidecars.pool = g_thread_pool_new(sidecar_worker, NULL, 1, FALSE, NULL);
+}
+
+// List the directory of a file that is about to play, in the background
+static void sidecar_prefetch(const char *path) {
+    if (sidecars.pool && !strstr(path, "://")) {
+        sidecar_push(g_path_get_dirname(path), NULL);
+    }
+}
+
+// "en", "eng", "pt-BR"
+static gboolean is_language_tag(const char *tag, size_t len) {
+    size_t letters = 0;
+    while (letters < len && g_ascii_isalpha(tag[letters])) {
+        letters++;
+    }
+    if (letters < 2 || letters > 3) {
+        return FALSE;
+    }
+    if (letters == len) {
+        return TRUE;
+    }
+    if (tag[letters] != '-' || len - letters - 1 < 2 || len - letters - 1 > 4) {
+        return FALSE;
+    }
+    for (size_t i = letters + 1; i < len; ++i) {
+        if (!g_ascii_isalnum(tag[i])) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Whether name is a sidecar of the video whose name without extension is
+// stem (ignoring case): stem.<ext> or stem.<language>.<ext>, with a subtitle
+// extension. Anything else in between ("Show.S01E02.srt" next to
+// "Show.mkv") belongs to some other video. lang gets the language tag, or
+// "" if there is none.
+static gboolean sidecar_match(const char *name, const char *stem, char *lang, size_t lang_size) {
+    size_t len = strlen(stem);
+    if (g_ascii_strncasecmp(name, stem, len) != 0 || name[len] != '.' || !is_subtitle_file(name)) {
+        return FALSE;
+    }
+    const char *tag = name + len + 1;
+    const char *ext = strrchr(name, '.');
+    lang[0] = '\0';
+    if (ext == tag - 1) {
+        return TRUE;
+    }
+    size_t tag_len = ext - tag;
+    if (memchr(tag, '.', tag_len) || !is_language_tag(tag, tag_len) || tag_len >= lang_size) {
+        return FALSE;
+    }
+    memcpy(lang, tag, tag_len);
+    lang[tag_len] = '\0';
+    return TRUE;
+}
+
+static void sidecar_attach_unref(SidecarAttach *attach) {
+    if (!g_atomic_int_dec_and_test(&attach->refs)) {
+        return;
+    }
+    if (attach->attached > 0) {
+        g_debug("Subtitles: %d sidecar file(s) for %s", attach->attached, attach->path);
+    }
+    mpv_hook_continue(attach->app->mpv, attach->hook_id);
+    g_free(attach->path);
+    g_free(attach);
+}
+
+static void on_sidecar_added(AppData *app, const MpvReply *reply, gpointer user_data) {
+    SidecarAttach *attach = (SidecarAttach *)user_data;
+    if (reply->error < 0) {
+        fprintf(stderr, "Subtitles: a sidecar of %s failed to load: %s\n", attach->path,
+                mpv_error_string(reply->error));
+    } else {
+        g_atomic_int_inc(&attach->attached);
+    }
+    sidecar_attach_unref(attach);
+}
+
+// Send a sub-add for each of names (may be NULL) that is a sidecar of the
+// file being opened, then drop the sender's reference. "auto" leaves picking
+// a subtitle to mpv's usual track selection (slang and friends).
+static void sidecar_attach_send(SidecarAttach *attach, GPtrArray *names) {
+    char *dir = g_path_get_dirname(attach->path);
+    char *stem = g_path_get_basename(attach->path);
+    char *dot = strrchr(stem, '.');
+    if (dot && dot != stem) {
+        *dot = '\0';
+    }
+    char lang[16];
+    for (guint i = 0; names && i < names->len; ++i) {
+        const char *name = g_ptr_array_index(names, i);
+        if (!sidecar_match(name, stem, lang, sizeof(lang))) {
+            continue;
+        }
+        char *file = g_build_filename(dir, name, NULL);
+        const char *cmd[] = {"sub-add", file, "auto", name, lang[0] ? lang : NULL, NULL};
+        g_atomic_int_inc(&attach->refs);
+        async_command(attach->app, cmd, on_sidecar_added, attach);
+        g_free(file);
+    }
+    g_free(stem);
+    g_free(dir);
+    sidecar_attach_unref(attach);
+}
+
+// Attach the sidecars of path (on_preloaded hook, event thread) and continue
+// the hook once they are in. Nothing here blocks: a cached listing is
+// matched right away, anything else goes to the worker first.
+static void attach_subtitle_sidecars(AppData *app, const char *path, uint64_t hook_id) {
+    SidecarAttach *attach = g_new0(SidecarAttach, 1);
+    attach->app = app;
+    attach->path = g_strdup(path);
+    attach->hook_id = hook_id;
+    attach->refs = 1;
+    if (strstr(path, "://") || !sidecars.pool) {
+        sidecar_attach_unref(attach);
+        return;
+    }
+    char *dir = g_path_get_dirname(path);
+    GPtrArray *names = sidecar_dir_names(dir, FALSE);
+    if (names) {
+        sidecar_attach_send(attach, names);
+        g_ptr_array_unref(names);
+        g_free(dir);
+    } else {
+        sidecar_push(dir, attach);
+    }
+}
+
+static void sidecar_shutdown(void) {
+    g_thread_pool_free(sidecars.pool, TRUE, TRUE);
+    sidecars.pool = NULL;
+    g_hash_table_destroy(sidecars.dirs);
+    g_mutex_clear(&sidecars.lock);
+}
+
+// Where to pick up the file a saved session was playing. Handed from the GTK
+// thread to the on_load hook, which applies it to that file only.
+struct SessionResume {
+    char *path;
+    double position;
+    char aid[8], sid[8], vid[8]; // As mpv spells them: "auto", "no" or an id; empty to leave alone
+};
+
+static void session_resume_free(SessionResume *resume) {
+    g_free(resume->path);
+    g_free(resume);
+}
+
+// Start the opening file at position with the given tracks (empty: leave alone)
+static void set_file_start(mpv_handle *mpv, double position, const char *aid, const char *sid, const char *vid) {
+    char start[G_ASCII_DTOSTR_BUF_SIZE];
+    mpv_set_property_string(mpv, "file-local-options/start", g_ascii_dtostr(start, sizeof(start), position));
+    const char *names[] = {"file-local-options/aid", "file-local-options/sid", "file-local-options/vid"};
+    const char *values[] = {aid, sid, vid};
+    for (int i = 0; i < 3; ++i) {
+        if (values[i][0]) {
+            mpv_set_property_string(mpv, names[i], values[i]);
+        }
+    }
+}
+
+// Store a resume point handed over by the on_unload hook (GTK thread)
+static gboolean remember_unloaded(gpointer data) {
+    watch_later_remember((PlayerSnapshot *)data);
+    g_free(data);
+    return G_SOURCE_REMOVE;
+}
+
+// on_unload: close the file's resume point, with time-pos read while the
+// file is still there, and pass it to the GTK thread, which owns the log
+static void watched_unload(AppData *app, const char *path) {
+    PlayerSnapshot *done = g_new(PlayerSnapshot, 1);
+    g_mutex_lock(&app->watched_lock);
+    *done = app->watched;
+    app->watched.path[0] = '\0';
+    g_mutex_unlock(&app->watched_lock);
+    app->watched_closed = TRUE;
+
+    double position;
+    if (strcmp(done->path, path) == 0 &&
+        mpv_get_property(app->mpv, "time-pos", MPV_FORMAT_DOUBLE, &position) >= 0) {
+        done->time_pos = position;
+    }
+    if (strcmp(done->path, path) == 0 && done->time_pos >= 0 && done->duration > 0) {
+        g_idle_add(remember_unloaded, done);
+    } else {
+        g_free(done);
+    }
+}
+
+// on_load, on_preloaded and on_unload hooks, on the event thread. Options set through
+// file-local-options in on_load take effect as the file opens, so its first
+// frame is already at the resume point with the saved tracks (no seek
+// afterwards), and they do not carry over to the next file. The session
+// being resumed wins over the watch-later store for its own file. Subtitle
+// sidecars are added in on_preloaded, once the file is open but before its
+// tracks are selected; that hook is continued from the sub-add replies.
+// on_unload records where the file got to. mpv waits for mpv_hook_continue,
+// whatever happens.
+static void run_load_hook(AppData *app, mpv_event_hook *hook) {
+    char *path = mpv_get_property_string(app->mpv, "path");
+    if (path && strcmp(hook->name, "on_unload") == 0) {
+        watched_unload(app, path);
+    } else if (path && strcmp(hook->name, "on_preloaded") == 0) {
+        attach_subtitle_sidecars(app, path, hook->id); // Continues the hook itself
+        mpv_free(path);
+        return;
+    } else if (path && strcmp(hook->name, "on_load") == 0) {
+        SessionResume *resume = g_atomic_pointer_get(&app->resume);
+        if (resume && !g_atomic_pointer_compare_and_exchange(&app->resume, resume, NULL)) {
+            resume = NULL;
+        }
+        WatchRecord record;
+        if (resume && strcmp(path, resume->path) == 0) { // Not if the user picked something else meanwhile
+            set_file_start(app->mpv, resume->position, resume->aid, resume->sid, resume->vid);
+        } else if (watch_later_lookup(path, &record) && !(record.flags & WATCH_COMPLETED) &&
+                   record.position >= WATCH_MIN_POSITION) {
+            g_debug("Resuming %s at %.0fs", path, record.position);
+            set_file_start(app->mpv, record.position, record.aid, record.sid, record.vid);
+        }
+        if (resume) {
+            session_resume_free(resume);
+        }
+    }
+    if (path) {
+        mpv_free(path);
+    }
+    mpv_hook_continue(app->mpv, hook->id);
+}
+
+// Function to handle MPV events
+// Runs on the mpv event thread whenever the wakeup source fires. Drains every
+// queued event and returns, so the thread sleeps in poll() until mpv wakes it.
+static gboolean handle_mpv_events(gpointer data) {
+    AppData *app = (AppData *)data;
+    mpv_handle *mpv = app->mpv;
+
+    while (1) {
+        mpv_event *event = mpv_wait_event(mpv, 0);
+        if (event == NULL || event->event_id == MPV_EVENT_NONE) {
+            break;
+        }
+
+        switch (event->event_id) {
+            case MPV_EVENT_SHUTDOWN:
+                printf("MPV: Shutdown event received.\n");
+                g_idle_add((GSourceFunc)gtk_main_quit, NULL);
+                g_main_loop_quit(app->mpv_event_loop);
+                return G_SOURCE_REMOVE;
+                case MPV_EVENT_FILE_LOADED:
+                printf("MPV: File loaded.\n");
+                startup_mark("first file loaded");
+                break;
+            case MPV_EVENT_PLAYBACK_RESTART:
+                printf("MPV: Playback started.\n");
+                startup_profile_report("first file playing");
+                mark_ui_dirty(app, UI_DIRTY_SEEK); // Any seek in flight has landed
+                break;
+            case MPV_EVENT_COMMAND_REPLY:
+            case MPV_EVENT_SET_PROPERTY_REPLY:
+            case MPV_EVENT_GET_PROPERTY_REPLY:
+                complete_async_request(app, event);
+                break;
+            case MPV_EVENT_PROPERTY_CHANGE:
+                store_observed_property(app, event->reply_userdata, (mpv_event_property *)event->data);
+                break;
+            case MPV_EVENT_HOOK:
+                run_load_hook(app, (mpv_event_hook *)event->data);
+                break;
+            case MPV_EVENT_END_FILE: {
+            mpv_event_end_file *end = (mpv_event_end_file *)event->data;
+            printf("MPV: End of file.\n");
+            mark_ui_dirty(app, UI_DIRTY_SEEK); // A seek past the end never restarts
+            // Only move on when the file finished (or failed) by itself; a stop
+            // or a replacing loadfile from the playlist reports REASON_STOP.
+            // With a mirrored playlist mpv has already moved on by itself.
+            if (!app->gapless &&
+                (end->reason == MPV_END_FILE_REASON_EOF || end->reason == MPV_END_FILE_REASON_ERROR)) {
+                g_idle_add((GSourceFunc)play_next_in_queue, app);
+            }
+            break;
+            }
+            default:
+                printf("MPV: Unhandled event: %s\n", mpv_event_name(event->event_id));
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// The wakeup source only becomes ready when mpv says there is something to
+// read. Several wakeups before the next dispatch collapse into one drain.
+static gboolean mpv_event_source_dispatch(GSource *source, GSourceFunc callback, gpointer user_data) {
+    g_source_set_ready_time(source, -1); // Re-arm before draining so no wakeup is lost
+    return callback(user_data);
+}
+
+static GSourceFuncs mpv_event_source_funcs = {
+    NULL, NULL, mpv_event_source_dispatch, NULL
+};
+
+// Called by mpv from any of its threads. It must not call into the mpv API,
+// so all it does is mark the wakeup source ready (thread-safe in GLib).
+static void on_mpv_wakeup(void *data) {
+    AppData *app = (AppData *)data;
+    g_source_set_ready_time(app->mpv_event_source, 0);
+}
+
+// Body of mpv_thread: runs a private main context that only wakes up for
+// mpv events. Returns once handle_mpv_events sees MPV_EVENT_SHUTDOWN.
+static gpointer mpv_event_thread(gpointer data) {
+    AppData *app = (AppData *)data;
+    g_main_context_push_thread_default(app->mpv_event_context);
+    g_main_loop_run(app->mpv_event_loop);
+    g_main_context_pop_thread_default(app->mpv_event_context);
+    return NULL;
+}
+
+// Correct helper function to find a property in an mpv_node_list
+static mpv_node* mpv_node_list_find_property(mpv_node_list *list, const char *key) {
+    if (!list || !key)
+        return NULL;
+
+    for (int i = 0; i < list->num; ++i) {
+        if (list->keys && list->keys[i] && strcmp(list->keys[i], key) == 0) {
+            return &list->values[i];
+        }
+    }
+
+    return NULL;
+}
+
+static const char *const track_type_names[TRACK_TYPE_COUNT] = {"video", "audio", "sub"};
+static const char *const track_type_properties[TRACK_TYPE_COUNT] = {"vid", "aid", "sid"};
+
+static void track_info_clear(gpointer data) {
+    TrackInfo *track = data;
+    g_free(track->lang);
+    g_free(track->title);
+    g_free(track->codec);
+}
+
+static char *track_node_string(mpv_node_list *map, const char *key) {
+    mpv_node *value = mpv_node_list_find_property(map, key);
+    return value && value->format == MPV_FORMAT_STRING && value->u.string[0] ? g_strdup(value->u.string) : NULL;
+}
+
+static gboolean track_node_flag(mpv_node_list *map, const char *key) {
+    mpv_node *value = mpv_node_list_find_property(map, key);
+    return value && value->format == MPV_FORMAT_FLAG && value->u.flag;
+}
+
+// Whether the tracks of one type differ between two lists. Which one is
+// selected is left out: that only moves the mark in the menu.
+static gboolean track_type_changed(GArray *old, GArray *tracks, TrackType type) {
+    guint i = 0, j = 0;
+    for (;;) {
+        while (old && i < old->len && g_array_index(old, TrackInfo, i).type != type) {
+            i++;
+        }
+        while (tracks && j < tracks->len && g_array_index(tracks, TrackInfo, j).type != type) {
+            j++;
+        }
+        gboolean old_done = !old || i >= old->len;
+        gboolean new_done = !tracks || j >= tracks->len;
+        if (old_done || new_done) {
+            return old_done != new_done;
+        }
+        const TrackInfo *a = &g_array_index(old, TrackInfo, i++);
+        const TrackInfo *b = &g_array_index(tracks, TrackInfo, j++);
+        if (a->id != b->id || a->is_default != b->is_default || a->forced != b->forced ||
+            g_strcmp0(a->lang, b->lang) != 0 || g_strcmp0(a->title, b->title) != 0 ||
+            g_strcmp0(a->codec, b->codec) != 0) {
+            return TRUE;
+        }
+    }
+}
+
+// Replace the track model with the tracks of a "track-list" node (NULL
+// clears it) and count them by type. Runs on the event thread.
+static void track_model_update(const mpv_node *node, int counts[TRACK_TYPE_COUNT]) {
+    GArray *tracks = NULL;
+    if (node && node->format == MPV_FORMAT_NODE_ARRAY) {
+        mpv_node_list *list = node->u.list;
+        tracks = g_array_sized_new(FALSE, TRUE, sizeof(TrackInfo), list->num);
+        g_array_set_clear_func(tracks, track_info_clear);
+        for (int i = 0; i < list->num; ++i) {
+            if (list->values[i].format != MPV_FORMAT_NODE_MAP) {
+                continue;
+            }
+            mpv_node_list *map = list->values[i].u.list;
+            mpv_node *type = mpv_node_list_find_property(map, "type");
+            mpv_node *id = mpv_node_list_find_property(map, "id");
+            if (!type || type->format != MPV_FORMAT_STRING || !id || id->format != MPV_FORMAT_INT64) {
+                continue;
+            }
+            TrackInfo track = {.id = id->u.int64, .type = TRACK_TYPE_COUNT};
+            for (int t = 0; t < TRACK_TYPE_COUNT; ++t) {
+                if (strcmp(type->u.string, track_type_names[t]) == 0) {
+                    track.type = t;
+                }
+            }
+            if (track.type == TRACK_TYPE_COUNT) {
+                continue;
+            }
+            track.lang = track_node_string(map, "lang");
+            track.title = track_node_string(map, "title");
+            track.codec = track_node_string(map, "codec");
+            track.is_default = track_node_flag(map, "default");
+            track.forced = track_node_flag(map, "forced");
+            track.selected = track_node_flag(map, "selected");
+            counts[track.type]++;
+            g_array_append_vals(tracks, &track, 1);
+        }
+    }
+    GArray *old = track_model.tracks; // Only this thread replaces it, so no lock to read
+    gboolean changed[TRACK_TYPE_COUNT];
+    for (int t = 0; t < TRACK_TYPE_COUNT; ++t) {
+        changed[t] = track_type_changed(old, tracks, t);
+    }
+    g_mutex_lock(&track_model.lock);
+    track_model.tracks = tracks;
+    for (int t = 0; t < TRACK_TYPE_COUNT; ++t) {
+        track_model.generation[t] += changed[t];
+    }
+    g_mutex_unlock(&track_model.lock);
+    if (old) {
+        g_array_unref(old); // Freed once the last reader lets go
+    }
+}
+
+// A reference to the current tracks (NULL if there are none) and the
+// generation of the given type they belong to; g_array_unref it
+static GArray *track_model_get(TrackType type, guint *generation) {
+    g_mutex_lock(&track_model.lock);
+    GArray *tracks = track_model.tracks ? g_array_ref(track_model.tracks) : NULL;
+    *generation = track_model.generation[type];
+    g_mutex_unlock(&track_model.lock);
+    return tracks;
+}
+
+static void track_model_shutdown(void) {
+    if (track_model.tracks) {
+        g_array_unref(track_model.tracks);
+        track_model.tracks = NULL;
+    }
+}
+
+// Function to toggle pause (GTK callback)
+static void on_play_pause_clicked(GtkWidget *button, AppData *app) {
+    if (!app->mpv) {
+        fprintf(stderr, "MPV is not initialized.\n");
+        return;
+    }
+    // Let mpv flip it; no need to read the current state first
+    async_command(app, (const char *[]){"cycle", "pause", NULL}, NULL, NULL);
+
+    // The button icon follows the observed "pause" property
+}
+
+// Function to stop playback (GTK callback)
+static void on_stop_clicked(GtkWidget *button, AppData *app) {
+    const char *cmd[] = {"stop", NULL};
+    async_command(app, cmd, NULL, NULL);
+    mpv_playlist_forget(app); // "stop" empties mpv's playlist
+}
+
+// Background metadata prober. Worker threads open playlist files with their
+// own headless mpv handle and report duration, size, codecs and track counts.
+// Results are cached on disk keyed by path, size and mtime.
+#define PROBE_MAX_WORKERS 4
+#define PROBE_TIMEOUT 10.0 // Seconds one file may take to open
+
+typedef struct {
+    double duration;
+    int width, height;
+    char video_codec[32];
+    char audio_codec[32];
+    int audio_tracks;
+    int sub_tracks;
+} MediaInfo;
+
+typedef struct {
+    gint64 size;
+    gint64 mtime;
+    MediaInfo info;
+} CachedMediaInfo;
+
+typedef struct {
+    guint entry_id;
+    char *path;
+    GList link;       // In urgent or backlog while queued
+    gboolean urgent;
+    gboolean ok;      // info is valid
+    MediaInfo info;
+} ProbeJob;
+
+typedef struct {
+    AppData *app;
+    GMutex lock;
+    GCond wake;
+    GThread *workers[PROBE_MAX_WORKERS];
+    mpv_handle *handles[PROBE_MAX_WORKERS]; // Woken on shutdown so a slow file can't hold it up
+    int worker_count;
+    gint quit;
+    GQueue urgent;         // Jobs for rows on screen, taken first
+    GQueue backlog;
+    GHashTable *queued;    // entry id -> ProbeJob not taken by a worker yet
+    GPtrArray *finished;   // Jobs waiting for the GTK thread
+    gboolean flush_queued;
+    GHashTable *cache;     // path -> CachedMediaInfo
+    gboolean cache_dirty;
+    char *cache_file;
+} MetadataProber;
+
+static MetadataProber prober;
+
+static void probe_job_free(ProbeJob *job) {
+    g_free(job->path);
+    g_free(job);
+}
+
+static char *media_info_format(const MediaInfo *info) {
+    GString *text = g_string_new(NULL);
+    if (info->duration > 0) {
+        int total = (int)info->duration;
+        if (total >= 3600) {
+            g_string_append_printf(text, "%d:%02d:%02d", total / 3600, (total % 3600) / 60, total % 60);
+        } else {
+            g_string_append_printf(text, "%02d:%02d", total / 60, total % 60);
+        }
+    }
+    if (info->width > 0 && info->height > 0) {
+        g_string_append_printf(text, "  %dx%d", info->width, info->height);
+    }
+    if (info->video_codec[0] || info->audio_codec[0]) {
+        g_string_append_printf(text, "  %s%s%s", info->video_codec,
+                               info->video_codec[0] && info->audio_codec[0] ? "/" : "", info->audio_codec);
+    }
+    if (info->audio_tracks > 1) {
+        g_string_append_printf(text, "  %d audio", info->audio_tracks);
+    }
+    if (info->sub_tracks > 0) {
+        g_string_append_printf(text, "  %d subs", info->sub_tracks);
+    }
+    return g_string_free(text, FALSE);
+}
+
+// Cache file: one tab separated line per file, path escaped with g_strescape
+static void metadata_cache_load(void) {
+    char *contents = NULL;
+    if (!g_file_get_contents(prober.cache_file, &contents, NULL, NULL)) {
+        return; // First run
+    }
+    char **lines = g_strsplit(contents, "\n", -1);
+    for (char **line = lines; *line; ++line) {
+        char **f = g_strsplit(*line, "\t", -1);
+        if (g_strv_length(f) == 10) {
+            CachedMediaInfo *cached = g_new0(CachedMediaInfo, 1);
+            cached->size = g_ascii_strtoll(f[1], NULL, 10);
+            cached->mtime = g_ascii_strtoll(f[2], NULL, 10);
+            cached->info.duration = g_ascii_strtod(f[3], NULL);
+            cached->info.width = atoi(f[4]);
+            cached->info.height = atoi(f[5]);
+            g_strlcpy(cached->info.video_codec, f[6], sizeof(cached->info.video_codec));
+            g_strlcpy(cached->info.audio_codec, f[7], sizeof(cached->info.audio_codec));
+            cached->info.audio_tracks = atoi(f[8]);
+            cached->info.sub_tracks = atoi(f[9]);
+            g_hash_table_replace(prober.cache, g_strcompress(f[0]), cached);
+        }
+        g_strfreev(f);
+    }
+    g_strfreev(lines);
+    g_free(contents);
+}
+
+static void metadata_cache_save(void) {
+    if (!prober.cache_dirty) {
+        return;
+    }
+    GString *out = g_string_new(NULL);
+    GHashTableIter iter;
+    gpointer key, value;
+    g_hash_table_iter_init(&iter, prober.cache);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        CachedMediaInfo *cached = (CachedMediaInfo *)value;
+        char *path = g_strescape((const char *)key, NULL);
+        char duration[G_ASCII_DTOSTR_BUF_SIZE];
+        g_ascii_dtostr(duration, sizeof(duration), cached->info.duration);
+        g_string_append_printf(out, "%s\t%" G_GINT64_FORMAT "\t%" G_GINT64_FORMAT "\t%s\t%d\t%d\t%s\t%s\t%d\t%d\n",
+                               path, cached->size, cached->mtime, duration,
+                               cached->info.width, cached->info.height,
+                               cached->info.video_codec, cached->info.audio_codec,
+                               cached->info.audio_tracks, cached->info.sub_tracks);
+        g_free(path);
+    }
+    char *dir = g_path_get_dirname(prober.cache_file);
+    g_mkdir_with_parents(dir, 0700);
+    GError *error = NULL;
+    if (!g_file_set_contents(prober.cache_file, out->str, out->len, &error)) {
+        fprintf(stderr, "Failed to write metadata cache: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+    g_string_free(out, TRUE);
+    prober.cache_dirty = FALSE;
+}
+
+static void copy_codec_name(char *dst, size_t size, mpv_node *codec) {
+    if (codec && codec->format == MPV_FORMAT_STRING) {
+        g_strlcpy(dst, codec->u.string, size);
+        g_strdelimit(dst, "\t\n", ' '); // Keep the cache file parseable
+    }
+}
+
+// Read what we show from a file the worker's mpv has just opened
+static void read_media_info(mpv_handle *mpv, MediaInfo *info) {
+    memset(info, 0, sizeof(*info));
+    mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &info->duration);
+
+    mpv_node node;
+    if (mpv_get_property(mpv, "track-list", MPV_FORMAT_NODE, &node) < 0) {
+        return;
+    }
+    if (node.format == MPV_FORMAT_NODE_ARRAY) {
+        for (int i = 0; i < node.u.list->num; ++i) {
+            if (node.u.list->values[i].format != MPV_FORMAT_NODE_MAP) {
+                continue;
+            }
+            mpv_node_list *track = node.u.list->values[i].u.list;
+            mpv_node *type = mpv_node_list_find_property(track, "type");
+            if (!type || type->format != MPV_FORMAT_STRING) {
+                continue;
+            }
+            mpv_node *codec = mpv_node_list_find_property(track, "codec");
+            if (strcmp(type->u.string, "video") == 0 && info->width == 0) {
+                mpv_node *w = mpv_node_list_find_property(track, "demux-w");
+                mpv_node *h = mpv_node_list_find_property(track, "demux-h");
+                if (w && w->format == MPV_FORMAT_INT64 && h && h->format == MPV_FORMAT_INT64) {
+                    info->width = (int)w->u.int64;
+                    info->height = (int)h->u.int64;
+                }
+                copy_codec_name(info->video_codec, sizeof(info->video_codec), codec);
+            } else if (strcmp(type->u.string, "audio") == 0) {
+                if (info->audio_tracks++ == 0) {
+                    copy_codec_name(info->audio_codec, sizeof(info->audio_codec), codec);
+                }
+            } else if (strcmp(type->u.string, "sub") == 0) {
+                info->sub_tracks++;
+            }
+        }
+    }
+    mpv_free_node_contents(&node);
+}
+
+// Wait for any of the events in wanted (terminated by MPV_EVENT_NONE).
+// Returns it, or MPV_EVENT_NONE on timeout, shutdown or once *quit is set.
+static mpv_event_id wait_for_mpv_event(mpv_handle *mpv, const mpv_event_id *wanted, double timeout, gint *quit) {
+    gint64 deadline = g_get_monotonic_time() + (gint64)(timeout * G_USEC_PER_SEC);
+    while (!g_atomic_int_get(quit)) {
+        double left = (deadline - g_get_monotonic_time()) / (double)G_USEC_PER_SEC;
+        if (left <= 0) {
+            break;
+        }
+        mpv_event *event = mpv_wait_event(mpv, left);
+        for (const mpv_event_id *id = wanted; *id != MPV_EVENT_NONE; ++id) {
+            if (event->event_id == *id) {
+                return event->event_id;
+            }
+        }
+        if (event->event_id == MPV_EVENT_SHUTDOWN) {
+            break;
+        }
+    }
+    return MPV_EVENT_NONE;
+}
+
+static gboolean probe_file(mpv_handle *mpv, const char *path, MediaInfo *info) {
+    static const mpv_event_id file_events[] = {MPV_EVENT_FILE_LOADED, MPV_EVENT_END_FILE, MPV_EVENT_NONE};
+    const char *cmd[] = {"loadfile", path, NULL};
+    if (mpv_command(mpv, cmd) < 0) {
+        return FALSE;
+    }
+    mpv_event_id got = wait_for_mpv_event(mpv, file_events, PROBE_TIMEOUT, &prober.quit);
+    if (got == MPV_EVENT_FILE_LOADED) {
+        read_media_info(mpv, info);
+    }
+    if (got != MPV_EVENT_END_FILE && !g_atomic_int_get(&prober.quit)) {
+        // Swallow this file's END_FILE so it can't end the next probe early
+        mpv_command(mpv, (const char *[]){"stop", NULL});
+        while (wait_for_mpv_event(mpv, file_events, 1.0, &prober.quit) == MPV_EVENT_FILE_LOADED) {
+        }
+    }
+    return got == MPV_EVENT_FILE_LOADED;
+}
+
+static mpv_handle *create_probe_handle(void) {
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) {
+        return NULL;
+    }
+    mpv_set_option_string(mpv, "vo", "null");
+    mpv_set_option_string(mpv, "ao", "null");
+    mpv_set_option_string(mpv, "pause", "yes"); // Open only, don't decode ahead
+    mpv_set_option_string(mpv, "idle", "yes");
+    mpv_set_option_string(mpv, "config", "no");
+    mpv_set_option_string(mpv, "load-scripts", "no");
+    mpv_set_option_string(mpv, "ytdl", "no");
+    mpv_set_option_string(mpv, "cache", "no");
+    if (mpv_initialize(mpv) < 0) {
+        mpv_terminate_destroy(mpv);
+        return NULL;
+    }
+    return mpv;
+}
+
+// Runs on the GTK thread: fill in the rows of finished jobs
+static gboolean flush_probe_results(gpointer data) {
+    g_mutex_lock(&prober.lock);
+    GPtrArray *finished = prober.finished;
+    prober.finished = g_ptr_array_new();
+    prober.flush_queued = FALSE;
+    g_mutex_unlock(&prober.lock);
+
+    for (guint i = 0; i < finished->len; ++i) {
+        ProbeJob *job = g_ptr_array_index(finished, i);
+        gint index = playlist_index_of(job->entry_id);
+        if (index >= 0 && job->ok) { // Entry may have been removed meanwhile
+            PlaylistEntry *entry = playlist_get(index);
+            char *text = media_info_format(&job->info);
+            entry->duration = job->info.duration; // Saved with the playlist
+            gtk_list_store_set(prober.app->playlist_store, &entry->row, PLAYLIST_COL_INFO, text, -1);
+            g_free(text);
+        }
+        probe_job_free(job);
+    }
+    g_ptr_array_free(finished, TRUE);
+    return G_SOURCE_REMOVE;
+}
+
+static gpointer probe_worker(gpointer data) {
+    int slot = GPOINTER_TO_INT(data);
+    mpv_handle *mpv = create_probe_handle();
+    if (!mpv) {
+        static gint reported = 0; // Every worker fails the same way; say it once
+        if (g_atomic_int_compare_and_exchange(&reported, 0, 1)) {
+            fprintf(stderr, "Prober: could not create mpv handle\n");
+        }
+        return NULL;
+    }
+
+    g_mutex_lock(&prober.lock);
+    prober.handles[slot] = mpv;
+    while (!g_atomic_int_get(&prober.quit)) {
+        GList *link = g_queue_pop_head_link(&prober.urgent);
+        if (!link) {
+            link = g_queue_pop_head_link(&prober.backlog);
+        }
+        if (!link) {
+            g_cond_wait(&prober.wake, &prober.lock);
+            continue;
+        }
+        ProbeJob *job = (ProbeJob *)link->data;
+        g_hash_table_remove(prober.queued, GUINT_TO_POINTER(job->entry_id));
+        g_mutex_unlock(&prober.lock);
+
+        GStatBuf st;
+        gboolean have_stat = g_stat(job->path, &st) == 0;
+        g_mutex_lock(&prober.lock);
+        CachedMediaInfo *cached = have_stat ? g_hash_table_lookup(prober.cache, job->path) : NULL;
+        if (cached && cached->size == (gint64)st.st_size && cached->mtime == (gint64)st.st_mtime) {
+            job->info = cached->info;
+            job->ok = TRUE;
+        }
+        g_mutex_unlock(&prober.lock);
+
+        if (!job->ok && have_stat && probe_file(mpv, job->path, &job->info)) {
+            job->ok = TRUE;
+            cached = g_new0(CachedMediaInfo, 1);
+            cached->size = st.st_size;
+            cached->mtime = st.st_mtime;
+            cached->info = job->info;
+            g_mutex_lock(&prober.lock);
+            g_hash_table_replace(prober.cache, g_strdup(job->path), cached);
+            prober.cache_dirty = TRUE;
+            g_mutex_unlock(&prober.lock);
+        }
+
+        g_mutex_lock(&prober.lock);
+        g_ptr_array_add(prober.finished, job);
+        if (!prober.flush_queued) {
+            prober.flush_queued = TRUE;
+            g_idle_add(flush_probe_results, NULL);
+        }
+    }
+    prober.handles[slot] = NULL;
+    g_mutex_unlock(&prober.lock);
+    mpv_terminate_destroy(mpv);
+    return NULL;
+}
+
+static void metadata_prober_init(AppData *app) {
+    prober.app = app;
+    g_mutex_init(&prober.lock);
+    g_cond_init(&prober.wake);
+    g_queue_init(&prober.urgent);
+    g_queue_init(&prober.backlog);
+    prober.queued = g_hash_table_new(g_direct_hash, g_direct_equal);
+    prober.finished = g_ptr_array_new();
+    prober.cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    prober.cache_file = g_build_filename(g_get_user_cache_dir(), "eluxi-player", "metadata.tsv", NULL);
+    metadata_cache_load();
+}
+
+// Workers start with the first file, not at startup
+static void metadata_prober_start_workers(void) {
+    if (prober.worker_count > 0) {
+        return;
+    }
+    prober.worker_count = CLAMP((int)g_get_num_processors() / 2, 1, PROBE_MAX_WORKERS);
+    for (int i = 0; i < prober.worker_count; ++i) {
+        prober.workers[i] = g_thread_new("probe_worker", probe_worker, GINT_TO_POINTER(i));
+    }
+}
+
+static void metadata_probe_enqueue(PlaylistEntry *entry) {
+    metadata_prober_start_workers();
+    ProbeJob *job = g_new0(ProbeJob, 1);
+    job->entry_id = entry->id;
+    job->path = g_strdup(entry->path);
+    job->link.data = job;
+
+    g_mutex_lock(&prober.lock);
+    g_queue_push_tail_link(&prober.backlog, &job->link);
+    g_hash_table_insert(prober.queued, GUINT_TO_POINTER(job->entry_id), job);
+    g_cond_signal(&prober.wake);
+    g_mutex_unlock(&prober.lock);
+}
+
+// Called with prober.lock held
+static void drop_queued_job(ProbeJob *job) {
+    g_queue_unlink(job->urgent ? &prober.urgent : &prober.backlog, &job->link);
+    g_hash_table_remove(prober.queued, GUINT_TO_POINTER(job->entry_id));
+    probe_job_free(job);
+}
+
+static void metadata_probe_forget(guint entry_id) {
+    g_mutex_lock(&prober.lock);
+    ProbeJob *job = g_hash_table_lookup(prober.queued, GUINT_TO_POINTER(entry_id));
+    if (job) {
+        drop_queued_job(job);
+    }
+    g_mutex_unlock(&prober.lock);
+}
+
+static void metadata_probe_cancel_all(void) {
+    g_mutex_lock(&prober.lock);
+    GList *link;
+    while ((link = g_queue_peek_head_link(&prober.urgent)) || (link = g_queue_peek_head_link(&prober.backlog))) {
+        drop_queued_job((ProbeJob *)link->data);
+    }
+    g_mutex_unlock(&prober.lock);
+}
+
+// Rows scrolled into view jump the queue
+static void prioritize_visible_rows(AppData *app) {
+    GtkTreePath *start = NULL, *end = NULL;
+    if (!gtk_tree_view_get_visible_range(GTK_TREE_VIEW(app->playlist_view), &start, &end)) {
+        return;
+    }
+    gint first = gtk_tree_path_get_indices(start)[0];
+    gint last = gtk_tree_path_get_indices(end)[0];
+    gtk_tree_path_free(start);
+    gtk_tree_path_free(end);
+
+    g_mutex_lock(&prober.lock);
+    for (gint i = first; i <= last && i < (gint)playlist_length(); ++i) {
+        ProbeJob *job = g_hash_table_lookup(prober.queued, GUINT_TO_POINTER(playlist_get(i)->id));
+        if (job && !job->urgent) {
+            g_queue_unlink(&prober.backlog, &job->link);
+            g_queue_push_tail_link(&prober.urgent, &job->link);
+            job->urgent = TRUE;
+        }
+    }
+    g_mutex_unlock(&prober.lock);
+}
+
+static void on_playlist_scrolled(GtkAdjustment *adjustment, AppData *app) {
+    prioritize_visible_rows(app);
+}
+
+static void metadata_prober_shutdown(void) {
+    g_mutex_lock(&prober.lock);
+    g_atomic_int_set(&prober.quit, 1);
+    g_cond_broadcast(&prober.wake);
+    for (int i = 0; i < prober.worker_count; ++i) {
+        if (prober.handles[i]) {
+            mpv_wakeup(prober.handles[i]);
+        }
+    }
+    g_mutex_unlock(&prober.lock);
+    for (int i = 0; i < prober.worker_count; ++i) {
+        g_thread_join(prober.workers[i]);
+    }
+
+    metadata_probe_cancel_all();
+    g_ptr_array_foreach(prober.finished, (GFunc)probe_job_free, NULL);
+    g_ptr_array_free(prober.finished, TRUE);
+    metadata_cache_save();
+    g_hash_table_destroy(prober.queued);
+    g_hash_table_destroy(prober.cache);
+    g_free(prober.cache_file);
+    g_cond_clear(&prober.wake);
+    g_mutex_clear(&prober.lock);
+}
+
+// Play the entry of an activated playlist row
+static void on_playlist_row_activated(GtkTreeView *view, GtkTreePath *path, GtkTreeViewColumn *column, AppData *app) {
+    GtkTreeIter iter;
+    guint id = 0;
+    if (!gtk_tree_model_get_iter(GTK_TREE_MODEL(app->playlist_store), &iter, path)) {
+        return;
+    }
+    gtk_tree_model_get(GTK_TREE_MODEL(app->playlist_store), &iter, PLAYLIST_COL_ID, &id, -1);
+    play_playlist_index(app, playlist_index_of(id));
+}
+
+static void session_playlist_changed(AppData *app);
+
+// Delete removes the selected entry from the playlist
+static gboolean on_playlist_key_press(GtkWidget *view, GdkEventKey *event, AppData *app) {
+    if (event->keyval != GDK_KEY_Delete) {
+        return FALSE;
+    }
+    GtkTreeIter iter;
+    GtkTreeModel *model;
+    if (gtk_tree_selection_get_selected(gtk_tree_view_get_selection(GTK_TREE_VIEW(view)), &model, &iter)) {
+        guint id = 0;
+        gtk_tree_model_get(model, &iter, PLAYLIST_COL_ID, &id, -1);
+        if (id == app->playing_entry_id) {
+            app->playing_entry_id = 0;
+        }
+        gint index = playlist_index_of(id);
+        mpv_playlist_remove(app, index);
+        metadata_probe_forget(id);
+        playlist_remove(index);
+        gtk_list_store_remove(app->playlist_store, &iter);
+        session_playlist_changed(app);
+    }
+    return TRUE;
+}
+
+// Add one row for an entry that was just appended to the playlist and
+// remember it in the entry
+static void playlist_view_append(AppData *app, PlaylistEntry *entry) {
+    gtk_list_store_insert_with_values(app->playlist_store, &entry->row, -1,
+                                      PLAYLIST_COL_ID, entry->id,
+                                      PLAYLIST_COL_PATH, entry->title ? entry->title : entry->path,
+                                      PLAYLIST_COL_PLAYING, FALSE,
+                                      PLAYLIST_COL_INFO, "",
+                                      -1);
+    metadata_probe_enqueue(entry); // Fills in PLAYLIST_COL_INFO later
+    session_playlist_changed(app);
+}
+
+// Large inserts go in with the model detached, so the view neither
+// revalidates nor emits per-row signals until the batch is done.
+static void playlist_view_begin_batch(AppData *app) {
+    gtk_tree_view_set_model(GTK_TREE_VIEW(app->playlist_view), NULL);
+}
+
+static void playlist_view_end_batch(AppData *app) {
+    gtk_tree_view_set_model(GTK_TREE_VIEW(app->playlist_view), GTK_TREE_MODEL(app->playlist_store));
+}
+
+static void folder_import_cancel(void);
+static void on_playlist_load_clicked(GtkWidget *button, AppData *app);
+static void on_playlist_save_clicked(GtkWidget *button, AppData *app);
+
+static void playlist_view_clear(AppData *app) {
+    folder_import_cancel(); // Nothing more may stream into the old list
+    metadata_probe_cancel_all();
+    app->playing_entry_id = 0;
+    gtk_list_store_clear(app->playlist_store);
+}
+
+// Build the playlist popover. Rows have a fixed height, so GtkTreeView only
+// measures and renders the rows that are scrolled into view.
+static void create_playlist_view(AppData *app) {
+    app->playlist_store = gtk_list_store_new(PLAYLIST_N_COLS, G_TYPE_UINT, G_TYPE_STRING, G_TYPE_BOOLEAN,
+                                             G_TYPE_STRING);
+
+    GtkWidget *view = gtk_tree_view_new_with_model(GTK_TREE_MODEL(app->playlist_store));
+    gtk_tree_view_set_headers_visible(GTK_TREE_VIEW(view), FALSE);
+    gtk_tree_view_set_activate_on_single_click(GTK_TREE_VIEW(view), TRUE);
+    gtk_tree_view_set_search_column(GTK_TREE_VIEW(view), PLAYLIST_COL_PATH);
+
+    GtkCellRenderer *renderer = gtk_cell_renderer_text_new();
+    g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_MIDDLE, "foreground", "royalblue", NULL);
+    gtk_cell_renderer_text_set_fixed_height_from_font(GTK_CELL_RENDERER_TEXT(renderer), 1);
+    GtkTreeViewColumn *column = gtk_tree_view_column_new_with_attributes(
+        "File", renderer,
+        "text", PLAYLIST_COL_PATH,
+        "foreground-set", PLAYLIST_COL_PLAYING,
+        NULL);
+    gtk_tree_view_column_set_sizing(column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_expand(column, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(view), column);
+
+    GtkCellRenderer *info_renderer = gtk_cell_renderer_text_new();
+    g_object_set(info_renderer, "foreground", "gray", "xalign", 1.0, NULL);
+    gtk_cell_renderer_text_set_fixed_height_from_font(GTK_CELL_RENDERER_TEXT(info_renderer), 1);
+    GtkTreeViewColumn *info_column = gtk_tree_view_column_new_with_attributes(
+        "Info", info_renderer,
+        "text", PLAYLIST_COL_INFO,
+        NULL);
+    gtk_tree_view_column_set_sizing(info_column, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(info_column, 260);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(view), info_column);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(view), TRUE);
+
+    g_signal_connect(view, "row-activated", G_CALLBACK(on_playlist_row_activated), app);
+    g_signal_connect(view, "key-press-event", G_CALLBACK(on_playlist_key_press), app);
+
+    GtkWidget *scrolled = gtk_scrolled_window_new(NULL, NULL);
+    gtk_scrolled_window_set_policy(GTK_SCROLLED_WINDOW(scrolled), GTK_POLICY_NEVER, GTK_POLICY_AUTOMATIC);
+    gtk_scrolled_window_set_min_content_width(GTK_SCROLLED_WINDOW(scrolled), 760);
+    gtk_scrolled_window_set_min_content_height(GTK_SCROLLED_WINDOW(scrolled), 400);
+    gtk_container_add(GTK_CONTAINER(scrolled), view);
+    // Probe whatever the user is looking at first
+    g_signal_connect(gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(view)), "value-changed",
+                     G_CALLBACK(on_playlist_scrolled), app);
+    g_signal_connect_swapped(view, "map", G_CALLBACK(prioritize_visible_rows), app);
+
+    // Playlist files: open one (replacing the queue) or save the queue
+    GtkWidget *load_button = gtk_button_new_from_icon_name("document-open", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(load_button, "Open playlist");
+    g_signal_connect(load_button, "clicked", G_CALLBACK(on_playlist_load_clicked), app);
+    GtkWidget *save_button = gtk_button_new_from_icon_name("document-save", GTK_ICON_SIZE_BUTTON);
+    gtk_widget_set_tooltip_text(save_button, "Save playlist");
+    g_signal_connect(save_button, "clicked", G_CALLBACK(on_playlist_save_clicked), app);
+    GtkWidget *toolbar = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 4);
+    gtk_box_pack_start(GTK_BOX(toolbar), load_button, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(toolbar), save_button, FALSE, FALSE, 0);
+
+    GtkWidget *content = gtk_box_new(GTK_ORIENTATION_VERTICAL, 4);
+    gtk_box_pack_start(GTK_BOX(content), toolbar, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(content), scrolled, TRUE, TRUE, 0);
+
+    GtkWidget *popover = gtk_popover_new(app->playlist_button);
+    gtk_popover_set_position(GTK_POPOVER(popover), GTK_POS_TOP);
+    gtk_container_add(GTK_CONTAINER(popover), content);
+    gtk_widget_show_all(content);
+
+    app->playlist_view = view;
+    app->playlist_popover = popover;
+}
+
+// Show or hide the playlist popover
+static void toggle_playlist_visibility(AppData *app) {
+    if (gtk_widget_get_visible(app->playlist_popover)) {
+        gtk_popover_popdown(GTK_POPOVER(app->playlist_popover));
+    } else {
+        gtk_popover_popup(GTK_POPOVER(app->playlist_popover));
+    }
+}
+
+static void on_playlist_button_clicked(GtkWidget *button, AppData *app_data) {
+    toggle_playlist_visibility(app_data);
+}
+
+// Playlist files: M3U (plain and #EXTINF) and PLS. The parser walks the
+// mapped file once and hands each entry to a callback as soon as it is
+// complete; only the current line is ever copied.
+typedef void (*PlaylistEntryFunc)(char *path, const char *title, double duration, gpointer user_data);
+
+// One PLS entry; its keys may come in any order
+typedef struct {
+    char *path;
+    char *title;
+    double duration;
+} PlsEntry;
+
+#define PLS_MAX_ENTRIES 1000000 // Ignore absurd FileN numbers instead of allocating for them
+
+static gboolean is_playlist_file(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && (g_ascii_strcasecmp(dot, ".m3u") == 0 || g_ascii_strcasecmp(dot, ".m3u8") == 0 ||
+                   g_ascii_strcasecmp(dot, ".pls") == 0);
+}
+
+static gboolean is_pls_file(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && g_ascii_strcasecmp(dot, ".pls") == 0;
+}
+
+// Relative entries are relative to the playlist file; URLs are left to mpv
+static char *resolve_playlist_entry(const char *base_dir, const char *entry) {
+    if (g_str_has_prefix(entry, "file://")) {
+        return g_filename_from_uri(entry, NULL, NULL);
+    }
+    if (strstr(entry, "://") || g_path_is_absolute(entry)) {
+        return g_strdup(entry);
+    }
+    return g_build_filename(base_dir, entry, NULL);
+}
+
+// Copy the next line, without surrounding white space (CR included), into
+// line. Returns FALSE at the end of the data.
+static gboolean next_playlist_line(const char **cursor, const char *end, GString *line) {
+    if (*cursor >= end) {
+        return FALSE;
+    }
+    const char *start = *cursor;
+    const char *newline = memchr(start, '\n', end - start);
+    const char *stop = newline ? newline : end;
+    *cursor = newline ? newline + 1 : end;
+    while (start < stop && g_ascii_isspace(*start)) {
+        start++;
+    }
+    while (stop > start && g_ascii_isspace(stop[-1])) {
+        stop--;
+    }
+    g_string_truncate(line, 0);
+    g_string_append_len(line, start, stop - start);
+    return TRUE;
+}
+
+static guint parse_m3u(const char *data, const char *end, const char *base_dir,
+                       PlaylistEntryFunc func, gpointer user_data) {
+    GString *line = g_string_sized_new(256);
+    GString *title = g_string_sized_new(64);
+    gboolean have_info = FALSE;
+    double duration = -1;
+    guint count = 0;
+    while (next_playlist_line(&data, end, line)) {
+        if (g_str_has_prefix(line->str, "#EXTINF:")) {
+            // #EXTINF:<seconds>[ attributes],<title>
+            char *comma = strchr(line->str, ',');
+            duration = g_ascii_strtod(line->str + 8, NULL);
+            g_string_assign(title, comma ? g_strstrip(comma + 1) : "");
+            have_info = TRUE;
+        } else if (line->len > 0 && line->str[0] != '#') {
+            char *path = resolve_playlist_entry(base_dir, line->str);
+            if (path) {
+                func(path, have_info && title->len > 0 ? title->str : NULL, have_info ? duration : -1, user_data);
+                count++;
+            }
+            have_info = FALSE;
+        }
+    }
+    g_string_free(title, TRUE);
+    g_string_free(line, TRUE);
+    return count;
+}
+
+// PLS numbers its entries, so they are gathered by number and delivered in
+// that order once the file has been read
+static guint parse_pls(const char *data, const char *end, const char *base_dir,
+                       PlaylistEntryFunc func, gpointer user_data) {
+    static const char *const keys[] = {"File", "Title", "Length"};
+    GArray *entries = g_array_new(FALSE, TRUE, sizeof(PlsEntry));
+    GString *line = g_string_sized_new(256);
+    while (next_playlist_line(&data, end, line)) {
+        for (guint k = 0; k < G_N_ELEMENTS(keys); ++k) {
+            size_t key_len = strlen(keys[k]);
+            if (g_ascii_strncasecmp(line->str, keys[k], key_len) != 0 || !g_ascii_isdigit(line->str[key_len])) {
+                continue;
+            }
+            char *value = NULL;
+            guint64 number = g_ascii_strtoull(line->str + key_len, &value, 10);
+            if (*value != '=' || number == 0 || number > PLS_MAX_ENTRIES) {
+                break;
+            }
+            value = g_strstrip(value + 1);
+            if (number > entries->len) {
+                guint old_len = entries->len;
+                g_array_set_size(entries, number);
+                for (guint i = old_len; i < number; ++i) {
+                    g_array_index(entries, PlsEntry, i).duration = -1;
+                }
+            }
+            PlsEntry *entry = &g_array_index(entries, PlsEntry, number - 1);
+            if (k == 0) {
+                g_free(entry->path);
+                entry->path = resolve_playlist_entry(base_dir, value);
+            } else if (k == 1) {
+                g_free(entry->title);
+                entry->title = value[0] ? g_strdup(value) : NULL;
+            } else {
+                entry->duration = g_ascii_strtod(value, NULL);
+            }
+            break;
+        }
+    }
+    guint count = 0;
+    for (guint i = 0; i < entries->len; ++i) {
+        PlsEntry *entry = &g_array_index(entries, PlsEntry, i);
+        if (entry->path) {
+            func(entry->path, entry->title, entry->duration, user_data);
+            count++;
+        }
+        g_free(entry->title);
+    }
+    g_string_free(line, TRUE);
+    g_array_free(entries, TRUE);
+    return count;
+}
+
+// Call func for every entry of the playlist at path, in playlist order.
+// func takes ownership of the path it is given.
+static gboolean playlist_file_parse(const char *path, PlaylistEntryFunc func, gpointer user_data,
+                                    guint *count, GError **error) {
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, error);
+    if (!mapped) {
+        return FALSE;
+    }
+    const char *data = g_mapped_file_get_contents(mapped); // NULL for an empty file
+    const char *end = data + g_mapped_file_get_length(mapped);
+    if (data && end - data >= 3 && memcmp(data, "\xEF\xBB\xBF", 3) == 0) {
+        data += 3; // UTF-8 BOM
+    }
+    char *base_dir = g_path_get_dirname(path);
+    guint found = 0;
+    if (data) {
+        found = is_pls_file(path) ? parse_pls(data, end, base_dir, func, user_data)
+                                  : parse_m3u(data, end, base_dir, func, user_data);
+    }
+    if (count) {
+        *count = found;
+    }
+    g_free(base_dir);
+    g_mapped_file_unref(mapped);
+    return TRUE;
+}
+
+// Entries under the playlist's own directory are stored relative to it,
+// so a folder of media and its playlist can be moved together
+static const char *playlist_relative_path(const char *path, const char *base_dir) {
+    size_t len = strlen(base_dir);
+    if (strncmp(path, base_dir, len) == 0 && path[len] == G_DIR_SEPARATOR && path[len + 1]) {
+        return path + len + 1;
+    }
+    return path;
+}
+
+// Write the current playlist, from entry first on, to path, as PLS if it ends
+// in .pls and as extended M3U otherwise. The file is replaced atomically.
+static gboolean playlist_file_write(const char *path, guint first, GError **error) {
+    char *tmp_path = g_strdup_printf("%s.XXXXXX", path);
+    int fd = g_mkstemp(tmp_path);
+    if (fd >= 0) {
+        fchmod(fd, 0644); // mkstemp creates it private
+    }
+    FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+    if (!out) {
+        int saved_errno = errno;
+        if (fd >= 0) {
+            close(fd);
+            g_unlink(tmp_path);
+        }
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "%s: %s", path,
+                    g_strerror(saved_errno));
+        g_free(tmp_path);
+        return FALSE;
+    }
+    char *base_dir = g_path_get_dirname(path);
+    gboolean pls = is_pls_file(path);
+    char number[G_ASCII_DTOSTR_BUF_SIZE];
+    fputs(pls ? "[playlist]\n" : "#EXTM3U\n", out);
+    for (guint i = first; i < playlist_length(); ++i) {
+        PlaylistEntry *entry = playlist_get(i);
+        const char *file = playlist_relative_path(entry->path, base_dir);
+        guint n = i - first + 1;
+        // Whole seconds in both formats, -1 when unknown
+        g_snprintf(number, sizeof(number), "%.0f", entry->duration >= 0 ? entry->duration : -1.0);
+        if (pls) {
+            fprintf(out, "File%u=%s\n", n, file);
+            if (entry->title) {
+                fprintf(out, "Title%u=%s\n", n, entry->title);
+            }
+            fprintf(out, "Length%u=%s\n", n, number);
+        } else {
+            if (entry->title || entry->duration >= 0) {
+                fprintf(out, "#EXTINF:%s,%s\n", number, entry->title ? entry->title : "");
+            }
+            fprintf(out, "%s\n", file);
+        }
+    }
+    if (pls) {
+        fprintf(out, "NumberOfEntries=%u\nVersion=2\n", playlist_length() - MIN(first, playlist_length()));
+    }
+    g_free(base_dir);
+
+    gboolean ok = !ferror(out);
+    int saved_errno = errno;
+    if (fclose(out) != 0 && ok) {
+        ok = FALSE;
+        saved_errno = errno;
+    }
+    if (ok && g_rename(tmp_path, path) != 0) {
+        ok = FALSE;
+        saved_errno = errno;
+    }
+    if (!ok) {
+        g_unlink(tmp_path);
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(saved_errno), "%s: %s", path,
+                    g_strerror(saved_errno));
+    }
+    g_free(tmp_path);
+    return ok;
+}
+
+static void count_playlist_entry(char *path, const char *title, double duration, gpointer user_data) {
+    (*(guint *)user_data)++;
+    g_free(path);
+}
+
+// --bench-playlist: parse generated M3U and PLS files of a few megabytes
+static int run_playlist_benchmark(void) {
+    const guint entries = 100000;
+    static const char *const templates[] = {"eluxi-bench-XXXXXX.m3u8", "eluxi-bench-XXXXXX.pls"};
+    int failures = 0;
+    for (size_t t = 0; t < G_N_ELEMENTS(templates); ++t) {
+        char *path = g_build_filename(g_get_tmp_dir(), templates[t], NULL);
+        int fd = g_mkstemp(path);
+        FILE *out = fd >= 0 ? fdopen(fd, "w") : NULL;
+        if (!out) {
+            fprintf(stderr, "Playlist: cannot create %s: %s\n", path, g_strerror(errno));
+            g_free(path);
+            return 1;
+        }
+        gboolean pls = is_pls_file(path);
+        fputs(pls ? "[playlist]\n" : "#EXTM3U\n", out);
+        for (guint i = 1; i <= entries; ++i) {
+            guint show = i / 1000, season = i / 100 % 10 + 1, episode = i % 100;
+            if (pls) {
+                fprintf(out, "File%u=/srv/media/shows/Show %u/Season %02u/Show %u - S%02uE%03u.mkv\n"
+                             "Title%u=Show %u - Episode %u\nLength%u=%u\n",
+                        i, show, season, show, season, episode, i, show, episode, i, 1200 + i % 1800);
+            } else {
+                fprintf(out, "#EXTINF:%u,Show %u - Episode %u\n/srv/media/shows/Show %u/Season %02u/Show %u - S%02uE%03u.mkv\n",
+                        1200 + i % 1800, show, episode, show, season, show, season, episode);
+            }
+        }
+        if (pls) {
+            fprintf(out, "NumberOfEntries=%u\nVersion=2\n", entries);
+        }
+        fclose(out);
+
+        GStatBuf st;
+        g_stat(path, &st);
+        guint runs = 0;
+        gint64 start = g_get_monotonic_time();
+        gint64 elapsed;
+        do {
+            guint found = 0;
+            GError *error = NULL;
+            if (!playlist_file_parse(path, count_playlist_entry, &found, NULL, &error)) {
+                fprintf(stderr, "Playlist: %s\n", error->message);
+                g_error_free(error);
+                failures++;
+                break;
+            }
+            if (found != entries) {
+                fprintf(stderr, "Playlist: %s gave %u entries, expected %u\n", path, found, entries);
+                failures++;
+                break;
+            }
+            runs++;
+            elapsed = g_get_monotonic_time() - start;
+        } while (elapsed < G_USEC_PER_SEC / 2);
+        if (runs > 0) {
+            double seconds = elapsed / (double)G_USEC_PER_SEC / runs;
+            printf("Playlist: %-4s %u entries, %.1f MB: %.2f ms (%.0f MB/s, %.1fM entries/s)\n",
+                   pls ? "pls" : "m3u", entries, st.st_size / 1e6, seconds * 1e3,
+                   st.st_size / 1e6 / seconds, entries / 1e6 / seconds);
+        }
+        g_unlink(path);
+        g_free(path);
+    }
+    return failures ? 1 : 0;
+}
+
+// Folder import. Directory trees are read in parallel on a small thread pool,
+// one task per directory. Files come out in depth-first order with names in
+// natural order, and are streamed into the playlist in batches: a directory's
+// files are released once it and everything before it have been read.
+// Command-line arguments go through the same path, so the GTK thread never
+// stats them: each one is a task that may also be a file, glob or playlist.
+#define FOLDER_SCAN_MAX_THREADS 8
+#define FOLDER_BATCH_DETACH 500 // Bigger batches go in with the view's model detached
+
+static const char *const media_extension_list[] = {
+    "3gp", "aac", "ape", "avi", "flac", "flv", "m2ts", "m4a", "m4v", "mka", "mkv", "mov", "mp3", "mp4",
+    "mpeg", "mpg", "mts", "oga", "ogg", "ogv", "opus", "ts", "vob", "wav", "webm", "wma", "wmv", "wv", NULL
+};
+
+static GHashTable *media_extensions; // Lower-case extension -> itself, read-only once built
+
+// A playlist entry on its way in. Only playlist files supply title and duration.
+typedef struct {
+    char *path;
+    char *title;
+    double duration;
+} ImportItem;
+
+typedef struct ScanDir {
+    char *path;
+    struct ScanDir *parent;
+    GPtrArray *files;    // ImportItem, naturally sorted (playlists: in their order); NULL once emitted
+    GPtrArray *subdirs;  // ScanDir, naturally sorted; NULL once the whole subtree is emitted
+    guint next_subdir;   // Next subdir the emit cursor descends into
+    gboolean source;     // Named by the user, so not necessarily a directory
+    gboolean scanned;
+} ScanDir;
+
+typedef struct {
+    AppData *app;
+    GThreadPool *pool;
+    GMutex lock;           // Guards everything below except cancelled
+    ScanDir root;          // Its subdirs are the chosen folders; never scanned itself
+    ScanDir *cursor;       // Next directory whose files are due, NULL once all are out
+    GPtrArray *batch;      // Emitted ImportItems not yet handed to the GTK thread
+    gboolean batch_queued; // flush_folder_batch is pending
+    guint outstanding;     // Directories pushed to the pool and not yet read
+    gint cancelled;
+    gboolean started_playback;
+    guint found;
+    gint64 start_time;
+} FolderScan;
+
+static FolderScan *folder_scan;  // The scan feeding the playlist, NULL if none
+static GList *folder_scans;      // Every scan with work in flight, cancelled ones included
+
+static void build_media_extensions(void) {
+    media_extensions = g_hash_table_new(g_str_hash, g_str_equal);
+    for (const char *const *ext = media_extension_list; *ext; ++ext) {
+        g_hash_table_add(media_extensions, (gpointer)*ext);
+    }
+}
+
+static gboolean is_media_file(const char *name) {
+    const char *dot = strrchr(name, '.');
+    char ext[8];
+    size_t len = dot ? strlen(dot + 1) : 0;
+    if (len == 0 || len >= sizeof(ext)) {
+        return FALSE;
+    }
+    for (size_t i = 0; i <= len; ++i) {
+        ext[i] = g_ascii_tolower(dot[1 + i]);
+    }
+    return g_hash_table_contains(media_extensions, ext);
+}
+
+// strcmp, except that digit runs compare by value ("ep2" < "ep10") and
+// letters ignore ASCII case
+static int natural_compare(const char *a, const char *b) {
+    while (*a && *b) {
+        if (g_ascii_isdigit(*a) && g_ascii_isdigit(*b)) {
+            while (*a == '0') {
+                a++;
+            }
+            while (*b == '0') {
+                b++;
+            }
+            const char *digits_a = a, *digits_b = b;
+            while (g_ascii_isdigit(*a)) {
+                a++;
+            }
+            while (g_ascii_isdigit(*b)) {
+                b++;
+            }
+            size_t len_a = a - digits_a, len_b = b - digits_b;
+            if (len_a != len_b) {
+                return len_a < len_b ? -1 : 1;
+            }
+            int diff = memcmp(digits_a, digits_b, len_a);
+            if (diff != 0) {
+                return diff;
+            }
+            continue;
+        }
+        int diff = g_ascii_tolower(*a) - g_ascii_tolower(*b);
+        if (diff != 0) {
+            return diff;
+        }
+        a++;
+        b++;
+    }
+    return (unsigned char)*a - (unsigned char)*b;
+}
+
+static int compare_paths_natural(gconstpointer a, gconstpointer b) {
+    const char *path_a = *(const char *const *)a;
+    const char *path_b = *(const char *const *)b;
+    int diff = natural_compare(path_a, path_b);
+    return diff != 0 ? diff : strcmp(path_a, path_b);
+}
+
+static int compare_items_natural(gconstpointer a, gconstpointer b) {
+    const ImportItem *item_a = *(const ImportItem *const *)a;
+    const ImportItem *item_b = *(const ImportItem *const *)b;
+    return compare_paths_natural(&item_a->path, &item_b->path);
+}
+
+static int compare_scan_dirs_natural(gconstpointer a, gconstpointer b) {
+    const ScanDir *dir_a = *(const ScanDir *const *)a;
+    const ScanDir *dir_b = *(const ScanDir *const *)b;
+    return compare_paths_natural(&dir_a->path, &dir_b->path);
+}
+
+// Takes ownership of path
+static ImportItem *import_item_new(char *path, const char *title, double duration) {
+    ImportItem *item = g_new(ImportItem, 1);
+    item->path = path;
+    item->title = g_strdup(title);
+    item->duration = duration;
+    return item;
+}
+
+static void import_item_free(gpointer data) {
+    ImportItem *item = (ImportItem *)data;
+    g_free(item->path);
+    g_free(item->title);
+    g_free(item);
+}
+
+static ScanDir *scan_dir_new(const char *path, ScanDir *parent) {
+    ScanDir *dir = g_new0(ScanDir, 1);
+    dir->path = g_strdup(path);
+    dir->parent = parent;
+    return dir;
+}
+
+static void scan_dir_free(gpointer data) {
+    ScanDir *dir = (ScanDir *)data;
+    if (dir->files) {
+        g_ptr_array_unref(dir->files);
+    }
+    if (dir->subdirs) {
+        g_ptr_array_unref(dir->subdirs);
+    }
+    g_free(dir->path);
+    g_free(dir);
+}
+
+// Sort one directory entry into files or subdirs. Hidden entries and
+// symlinked directories (which could loop) are skipped.
+static void add_scan_entry(ScanDir *dir, int dir_fd, const char *name, unsigned char type,
+                           GPtrArray *files, GPtrArray *subdirs) {
+    if (name[0] == '.') {
+        return;
+    }
+    if (type == DT_UNKNOWN || type == DT_LNK) {
+        struct stat st;
+        if (fstatat(dir_fd, name, &st, 0) != 0) {
+            return;
+        }
+        if (S_ISDIR(st.st_mode)) {
+            type = type == DT_LNK ? DT_UNKNOWN : DT_DIR;
+        } else {
+            type = S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
+        }
+    }
+    if (type == DT_DIR) {
+        char *path = g_build_filename(dir->path, name, NULL);
+        g_ptr_array_add(subdirs, scan_dir_new(path, dir));
+        g_free(path);
+    } else if (type == DT_REG && is_media_file(name)) {
+        g_ptr_array_add(files, import_item_new(g_build_filename(dir->path, name, NULL), NULL, -1));
+    }
+}
+
+#ifdef __linux__
+// getdents64 hands over a whole buffer of entries per call, d_type included,
+// so most entries need no stat at all
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+#endif
+
+static void scan_directory(ScanDir *dir, GPtrArray *files, GPtrArray *subdirs) {
+    int fd = openat(AT_FDCWD, dir->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "Folder import: cannot open %s: %s\n", dir->path, strerror(errno));
+        return;
+    }
+#ifdef __linux__
+    char buffer[32 * 1024] __attribute__((aligned(8)));
+    long count;
+    while ((count = syscall(SYS_getdents64, fd, buffer, sizeof(buffer))) > 0) {
+        for (long offset = 0; offset < count;) {
+            struct linux_dirent64 *ent = (struct linux_dirent64 *)(buffer + offset);
+            add_scan_entry(dir, fd, ent->d_name, ent->d_type, files, subdirs);
+            offset += ent->d_reclen;
+        }
+    }
+    if (count < 0) {
+        fprintf(stderr, "Folder import: cannot read %s: %s\n", dir->path, strerror(errno));
+    }
+    close(fd);
+#else
+    DIR *stream = fdopendir(fd); // Takes over fd
+    if (!stream) {
+        close(fd);
+        return;
+    }
+    struct dirent *ent;
+    while ((ent = readdir(stream)) != NULL) {
+        add_scan_entry(dir, fd, ent->d_name, ent->d_type, files, subdirs);
+    }
+    closedir(stream);
+#endif
+    g_ptr_array_sort(files, compare_items_natural);
+    g_ptr_array_sort(subdirs, compare_scan_dirs_natural);
+}
+
+static void add_playlist_item(char *path, const char *title, double duration, gpointer user_data) {
+    g_ptr_array_add((GPtrArray *)user_data, import_item_new(path, title, duration));
+}
+
+// A path from the command line or a folder chooser: a directory is scanned,
+// a playlist read, a pattern that names nothing expanded as a glob, and
+// anything else (files, URLs) played as is
+static void scan_source(ScanDir *dir, GPtrArray *files, GPtrArray *subdirs) {
+    struct stat st;
+    GError *error = NULL;
+    if (strstr(dir->path, "://")) {
+        g_ptr_array_add(files, import_item_new(g_strdup(dir->path), NULL, -1));
+    } else if (stat(dir->path, &st) == 0) {
+        if (S_ISDIR(st.st_mode)) {
+            scan_directory(dir, files, subdirs);
+        } else if (is_playlist_file(dir->path)) {
+            if (!playlist_file_parse(dir->path, add_playlist_item, files, NULL, &error)) {
+                fprintf(stderr, "Import: %s\n", error->message);
+                g_error_free(error);
+            }
+        } else {
+            g_ptr_array_add(files, import_item_new(g_strdup(dir->path), NULL, -1));
+        }
+    } else if (strpbrk(dir->path, "*?[")) {
+        glob_t matches;
+        if (glob(dir->path, 0, NULL, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; ++i) {
+                const char *match = matches.gl_pathv[i];
+                if (stat(match, &st) == 0 && S_ISDIR(st.st_mode)) {
+                    g_ptr_array_add(subdirs, scan_dir_new(match, dir));
+                } else {
+                    g_ptr_array_add(files, import_item_new(g_strdup(match), NULL, -1));
+                }
+            }
+            globfree(&matches);
+        }
+        g_ptr_array_sort(files, compare_items_natural);
+        g_ptr_array_sort(subdirs, compare_scan_dirs_natural);
+    } else {
+        fprintf(stderr, "Import: %s: %s\n", dir->path, strerror(errno));
+    }
+}
+
+// Move every file that is now due into scan->batch: walk the tree depth-first
+// from the cursor until reaching a directory that has not been read yet.
+// Called with scan->lock held.
+static void folder_scan_emit(FolderScan *scan) {
+    ScanDir *dir = scan->cursor;
+    while (dir && dir->scanned) {
+        if (dir->files) {
+            for (guint i = 0; i < dir->files->len; ++i) {
+                g_ptr_array_add(scan->batch, g_ptr_array_index(dir->files, i));
+            }
+            g_ptr_array_set_free_func(dir->files, NULL); // The items now belong to batch
+            g_ptr_array_unref(dir->files);
+            dir->files = NULL;
+        }
+        if (dir->next_subdir < dir->subdirs->len) {
+            dir = g_ptr_array_index(dir->subdirs, dir->next_subdir++);
+            continue;
+        }
+        // Subtree done. No task can still refer to it: every directory in it was read.
+        g_ptr_array_unref(dir->subdirs);
+        dir->subdirs = NULL;
+        dir = dir->parent;
+    }
+    scan->cursor = dir;
+}
+
+static gboolean flush_folder_batch(gpointer data);
+static gboolean finish_folder_scan(gpointer data);
+
+// Thread pool function: read one directory and queue its subdirectories
+static void folder_scan_worker(gpointer data, gpointer user_data) {
+    ScanDir *dir = (ScanDir *)data;
+    FolderScan *scan = (FolderScan *)user_data;
+    GPtrArray *files = g_ptr_array_new_with_free_func(import_item_free);
+    GPtrArray *subdirs = g_ptr_array_new_with_free_func(scan_dir_free);
+    gboolean cancelled = g_atomic_int_get(&scan->cancelled);
+    if (!cancelled) {
+        if (dir->source) {
+            scan_source(dir, files, subdirs);
+        } else {
+            scan_directory(dir, files, subdirs);
+        }
+    }
+
+    g_mutex_lock(&scan->lock);
+    dir->files = files;
+    dir->subdirs = subdirs;
+    dir->scanned = TRUE;
+    scan->outstanding += subdirs->len;
+    gboolean notify = FALSE;
+    if (!cancelled) {
+        folder_scan_emit(scan);
+        notify = scan->batch->len > 0 && !scan->batch_queued;
+        scan->batch_queued |= notify;
+    }
+    gboolean finished = --scan->outstanding == 0;
+    g_mutex_unlock(&scan->lock);
+
+    // The batch goes first: once the children are pushed, the scan may finish
+    // (and be freed by finish_folder_scan) before this function returns
+    if (notify) {
+        g_idle_add(flush_folder_batch, scan);
+    }
+    for (guint i = 0; i < subdirs->len; ++i) {
+        g_thread_pool_push(scan->pool, g_ptr_array_index(subdirs, i), NULL);
+    }
+    if (finished) {
+        g_idle_add(finish_folder_scan, scan);
+    }
+}
+
+// Append a batch of items to the playlist, starting playback with the first one
+static void folder_import_append(FolderScan *scan, GPtrArray *items) {
+    AppData *app = scan->app;
+    gboolean detach = items->len > FOLDER_BATCH_DETACH;
+    if (detach) {
+        playlist_view_begin_batch(app);
+    }
+    for (guint i = 0; i < items->len; ++i) {
+        const ImportItem *item = g_ptr_array_index(items, i);
+        guint id = playlist_append(item->path, item->title, item->duration);
+        playlist_view_append(app, playlist_get(playlist_index_of(id)));
+    }
+    if (detach) {
+        playlist_view_end_batch(app);
+    }
+    mpv_playlist_send_appends(app);
+    scan->found += items->len;
+    if (!scan->started_playback && items->len > 0) {
+        scan->started_playback = TRUE;
+        play_next_in_queue_false(app);
+    }
+}
+
+static gboolean flush_folder_batch(gpointer data) {
+    FolderScan *scan = (FolderScan *)data;
+    g_mutex_lock(&scan->lock);
+    GPtrArray *items = scan->batch;
+    scan->batch = g_ptr_array_new_with_free_func(import_item_free);
+    scan->batch_queued = FALSE;
+    g_mutex_unlock(&scan->lock);
+
+    if (scan == folder_scan) {
+        folder_import_append(scan, items);
+    }
+    g_ptr_array_unref(items);
+    return G_SOURCE_REMOVE;
+}
+
+// Waits for any task still returning, so only call it once the scan is
+// finished or its queue no longer matters
+static void folder_scan_free(FolderScan *scan) {
+    g_thread_pool_free(scan->pool, TRUE, TRUE);
+    if (scan->root.subdirs) {
+        g_ptr_array_unref(scan->root.subdirs);
+    }
+    g_ptr_array_unref(scan->batch);
+    g_mutex_clear(&scan->lock);
+    g_free(scan);
+}
+
+// Queued by the worker that read the last directory
+static gboolean finish_folder_scan(gpointer data) {
+    FolderScan *scan = (FolderScan *)data;
+    flush_folder_batch(scan);
+    if (scan == folder_scan) {
+        printf("Import: %u files in %.2fs\n", scan->found,
+               (g_get_monotonic_time() - scan->start_time) / (double)G_USEC_PER_SEC);
+        folder_scan = NULL;
+    }
+    folder_scans = g_list_remove(folder_scans, scan);
+    folder_scan_free(scan);
+    return G_SOURCE_REMOVE;
+}
+
+// Stop feeding the playlist. The scan winds down on its own: queued
+// directories are skipped and finish_folder_scan frees it.
+static void folder_import_cancel(void) {
+    if (folder_scan) {
+        g_atomic_int_set(&folder_scan->cancelled, 1);
+        folder_scan = NULL;
+    }
+}
+
+// Replace the playlist with what paths (NULL-terminated) name; see scan_source
+static void folder_import_start(AppData *app, char **paths) {
+    playlist_clear();
+    playlist_view_clear(app); // Also cancels a running import
+    mpv_playlist_forget(app);
+    if (!media_extensions) {
+        build_media_extensions();
+    }
+
+    FolderScan *scan = g_new0(FolderScan, 1);
+    scan->app = app;
+    g_mutex_init(&scan->lock);
+    scan->batch = g_ptr_array_new_with_free_func(import_item_free);
+    scan->start_time = g_get_monotonic_time();
+    scan->root.scanned = TRUE;
+    scan->root.subdirs = g_ptr_array_new_with_free_func(scan_dir_free);
+    for (char **path = paths; *path; ++path) {
+        ScanDir *source = scan_dir_new(*path, &scan->root);
+        source->source = TRUE;
+        g_ptr_array_add(scan->root.subdirs, source); // Kept in the order given
+    }
+    scan->cursor = &scan->root;
+    scan->outstanding = scan->root.subdirs->len;
+    if (scan->outstanding == 0) {
+        folder_scan_free(scan);
+        return;
+    }
+    int threads = CLAMP((int)g_get_num_processors(), 2, FOLDER_SCAN_MAX_THREADS);
+    scan->pool = g_thread_pool_new(folder_scan_worker, scan, threads, FALSE, NULL);
+    folder_scan = scan;
+    folder_scans = g_list_prepend(folder_scans, scan);
+    for (guint i = 0; i < scan->root.subdirs->len; ++i) {
+        g_thread_pool_push(scan->pool, g_ptr_array_index(scan->root.subdirs, i), NULL);
+    }
+}
+
+static void folder_import_shutdown(void) {
+    folder_import_cancel();
+    for (GList *l = folder_scans; l; l = l->next) {
+        FolderScan *scan = (FolderScan *)l->data;
+        g_atomic_int_set(&scan->cancelled, 1);
+        folder_scan_free(scan); // Drops queued directories, waits for running ones
+    }
+    g_list_free(folder_scans);
+    folder_scans = NULL;
+    if (media_extensions) {
+        g_hash_table_destroy(media_extensions);
+    }
+}
+
+static void on_folder_open_clicked(GtkWidget *button, AppData *app) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Open Folder", GTK_WINDOW(app->window), GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Open", GTK_RESPONSE_ACCEPT,
+        NULL);
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        GSList *filenames = gtk_file_chooser_get_filenames(GTK_FILE_CHOOSER(dialog));
+        GPtrArray *folders = g_ptr_array_new_with_free_func(g_free);
+        for (GSList *iter = filenames; iter; iter = iter->next) {
+            g_ptr_array_add(folders, iter->data);
+        }
+        g_ptr_array_add(folders, NULL);
+        g_slist_free(filenames);
+        folder_import_start(app, (char **)folders->pdata);
+        g_ptr_array_unref(folders);
+    }
+    gtk_widget_destroy(dialog);
+}
+
+static void on_playlist_load_clicked(GtkWidget *button, AppData *app) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Open Playlist", GTK_WINDOW(app->window), GTK_FILE_CHOOSER_ACTION_OPEN,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Open", GTK_RESPONSE_ACCEPT,
+        NULL);
+    GtkFileFilter *filter = gtk_file_filter_new();
+    gtk_file_filter_set_name(filter, "Playlists (M3U, PLS)");
+    gtk_file_filter_add_pattern(filter, "*.[mM]3[uU]");
+    gtk_file_filter_add_pattern(filter, "*.[mM]3[uU]8");
+    gtk_file_filter_add_pattern(filter, "*.[pP][lL][sS]");
+    gtk_file_chooser_add_filter(GTK_FILE_CHOOSER(dialog), filter);
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        char *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        folder_import_start(app, (char *[]){path, NULL}); // Parsed off the GTK thread
+        g_free(path);
+    }
+    gtk_widget_destroy(dialog);
+}
+
+static void on_playlist_save_clicked(GtkWidget *button, AppData *app) {
+    GtkWidget *dialog = gtk_file_chooser_dialog_new(
+        "Save Playlist", GTK_WINDOW(app->window), GTK_FILE_CHOOSER_ACTION_SAVE,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Save", GTK_RESPONSE_ACCEPT,
+        NULL);
+    gtk_file_chooser_set_do_overwrite_confirmation(GTK_FILE_CHOOSER(dialog), TRUE);
+    gtk_file_chooser_set_current_name(GTK_FILE_CHOOSER(dialog), "playlist.m3u8");
+    if (gtk_dialog_run(GTK_DIALOG(dialog)) == GTK_RESPONSE_ACCEPT) {
+        char *path = gtk_file_chooser_get_filename(GTK_FILE_CHOOSER(dialog));
+        GError *error = NULL;
+        if (playlist_file_write(path, 0, &error)) {
+            printf("Saved %u playlist entries to %s\n", playlist_length(), path);
+        } else {
+            fprintf(stderr, "Could not save playlist: %s\n", error->message);
+            g_error_free(error);
+        }
+        g_free(path);
+    }
+    gtk_widget_destroy(dialog);
+}
+
+// Session file: the playlist and where playback was, saved on quit, on pause
+// or stop, shortly after the playlist changes and every SESSION_SAVE_INTERVAL
+// seconds while playing; restored with --resume.
+// Binary, in native byte order: a SessionHeader, then per entry a
+// SessionEntry followed by the path and title bytes (no terminators).
+// The entries are only rewritten when the playlist changed; saving the
+// position, volume and tracks rewrites the fixed-size header in place.
+#define SESSION_MAGIC "ELXS"
+#define SESSION_VERSION 1
+#define SESSION_BYTE_ORDER 0x01020304u // Reads back differently on a foreign machine
+#define SESSION_NO_TITLE G_MAXUINT32
+#define SESSION_SAVE_INTERVAL 15
+#define SESSION_SAVE_DELAY 2 // Seconds; one save covers a burst of playlist edits
+
+typedef struct {
+    char magic[4];
+    guint32 version;
+    guint32 byte_order;
+    guint32 entry_count;
+    gint32 current;       // Playlist index, -1 if none
+    guint32 reserved;
+    double position;      // Seconds into the current entry
+    double volume;
+    char aid[8], sid[8], vid[8];
+} SessionHeader;
+
+typedef struct {
+    double duration;
+    guint32 path_len;
+    guint32 title_len;    // SESSION_NO_TITLE if the entry has none
+} SessionEntry;
+
+static char *session_file_path(void) {
+    return g_build_filename(g_get_user_data_dir(), "eluxi-player", "session.bin", NULL);
+}
+
+// Overwrite just the header of a session file whose entries are current.
+// One small write at offset 0, no fsync or rename: this is what runs every
+// SESSION_SAVE_INTERVAL seconds during playback.
+static gboolean session_write_header(const SessionHeader *header) {
+    char *path = session_file_path();
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    g_free(path);
+    if (fd < 0) {
+        return FALSE;
+    }
+    gboolean ok = pwrite(fd, header, sizeof(*header), 0) == (ssize_t)sizeof(*header);
+    close(fd);
+    return ok;
+}
+
+// Write the session. The whole file goes through g_file_set_contents (a temp
+// file and a rename, so a crash leaves either the old file or the new one)
+// only when the entries changed since the last write, or when full is set.
+static void session_save(AppData *app, gboolean full) {
+    if (playlist_length() == 0) {
+        return; // Keep the last real session rather than saving an empty one
+    }
+    PlayerSnapshot snap;
+    player_state_read(&app->state, &snap);
+    SessionHeader header = {SESSION_MAGIC, SESSION_VERSION, SESSION_BYTE_ORDER, playlist_length(),
+                            playlist.current, 0, snap.time_pos, snap.volume, "", "", ""};
+    g_strlcpy(header.aid, snap.aid, sizeof(header.aid));
+    g_strlcpy(header.sid, snap.sid, sizeof(header.sid));
+    g_strlcpy(header.vid, snap.vid, sizeof(header.vid));
+    PlaylistEntry *current = playlist_current_entry();
+    if (!current || strcmp(current->path, snap.path) != 0) {
+        header.position = 0; // The position belongs to some other file
+    }
+    if (!full && app->session_playlist_saved && session_write_header(&header)) {
+        return;
+    }
+
+    GByteArray *out = g_byte_array_sized_new(sizeof(header) + playlist_length() * 96);
+    g_byte_array_append(out, (const guint8 *)&header, sizeof(header));
+    for (guint i = 0; i < playlist_length(); ++i) {
+        PlaylistEntry *entry = playlist_get(i);
+        SessionEntry record = {entry->duration, strlen(entry->path),
+                               entry->title ? strlen(entry->title) : SESSION_NO_TITLE};
+        g_byte_array_append(out, (const guint8 *)&record, sizeof(record));
+        g_byte_array_append(out, (const guint8 *)entry->path, record.path_len);
+        if (entry->title) {
+            g_byte_array_append(out, (const guint8 *)entry->title, record.title_len);
+        }
+    }
+
+    char *path = session_file_path();
+    char *dir = g_path_get_dirname(path);
+    GError *error = NULL;
+    g_mkdir_with_parents(dir, 0700);
+    if (g_file_set_contents(path, (const char *)out->data, out->len, &error)) {
+        app->session_playlist_saved = TRUE;
+    } else {
+        fprintf(stderr, "Session: %s\n", error->message);
+        g_error_free(error);
+    }
+    g_free(dir);
+    g_free(path);
+    g_byte_array_free(out, TRUE);
+}
+
+// Also keeps the playing file's watch-later record current, in case we crash
+static gboolean session_autosave(gpointer data) {
+    AppData *app = (AppData *)data;
+    PlayerSnapshot snap;
+    player_state_read(&app->state, &snap);
+    if (snap.path[0] && !snap.pause) {
+        session_save(app, FALSE);
+        watched_read(app, &snap);
+        watch_later_remember(&snap);
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Run the autosave timer only while something is playing; pausing or
+// stopping saves once and removes it
+static void session_autosave_update(AppData *app) {
+    PlayerSnapshot snap;
+    player_state_read(&app->state, &snap);
+    gboolean playing = snap.path[0] && !snap.pause;
+    if (playing && !app->session_timer) {
+        app->session_timer = g_timeout_add_seconds(SESSION_SAVE_INTERVAL, session_autosave, app);
+    } else if (!playing && app->session_timer) {
+        g_source_remove(app->session_timer);
+        app->session_timer = 0;
+        session_save(app, FALSE);
+    }
+}
+
+static gboolean session_save_pending(gpointer data) {
+    AppData *app = (AppData *)data;
+    app->session_save_id = 0;
+    session_save(app, FALSE);
+    return G_SOURCE_REMOVE;
+}
+
+static void session_playlist_changed(AppData *app) {
+    app->session_playlist_saved = FALSE;
+    if (!app->session_save_id) {
+        app->session_save_id = g_timeout_add_seconds(SESSION_SAVE_DELAY, session_save_pending, app);
+    }
+}
+
+// Rebuild the playlist from the session file and start the saved entry at
+// the saved position. Runs before the window is shown; *volume is set to the
+// saved volume. Returns FALSE (and leaves everything alone) if there is no
+// usable session.
+static gboolean session_restore(AppData *app, double *volume) {
+    gint64 start = g_get_monotonic_time();
+    char *path = session_file_path();
+    GMappedFile *mapped = g_mapped_file_new(path, FALSE, NULL);
+    g_free(path);
+    if (!mapped) {
+        return FALSE;
+    }
+    const char *data = g_mapped_file_get_contents(mapped);
+    gsize length = g_mapped_file_get_length(mapped);
+    SessionHeader header;
+    if (length < sizeof(header)) {
+        g_mapped_file_unref(mapped);
+        return FALSE;
+    }
+    memcpy(&header, data, sizeof(header));
+    header.aid[7] = header.sid[7] = header.vid[7] = '\0'; // Fixed-size fields from a file
+    if (memcmp(header.magic, SESSION_MAGIC, 4) != 0 || header.version != SESSION_VERSION ||
+        header.byte_order != SESSION_BYTE_ORDER) {
+        fprintf(stderr, "Session: unrecognised session file, ignoring it\n");
+        g_mapped_file_unref(mapped);
+        return FALSE;
+    }
+
+    playlist_clear();
+    playlist_view_clear(app);
+    playlist_view_begin_batch(app);
+    GString *entry_path = g_string_sized_new(256);
+    GString *title = g_string_sized_new(64);
+    gsize offset = sizeof(header);
+    guint count = 0;
+    while (count < header.entry_count && length - offset >= sizeof(SessionEntry)) {
+        SessionEntry record;
+        memcpy(&record, data + offset, sizeof(record));
+        offset += sizeof(record);
+        gsize title_len = record.title_len == SESSION_NO_TITLE ? 0 : record.title_len;
+        if (record.path_len > length - offset || title_len > length - offset - record.path_len) {
+            break; // Truncated; keep what was complete
+        }
+        g_string_truncate(entry_path, 0);
+        g_string_append_len(entry_path, data + offset, record.path_len);
+        offset += record.path_len;
+        g_string_truncate(title, 0);
+        g_string_append_len(title, data + offset, title_len);
+        offset += title_len;
+        guint id = playlist_append(entry_path->str, record.title_len == SESSION_NO_TITLE ? NULL : title->str,
+                                   record.duration);
+        playlist_view_append(app, playlist_get(playlist_index_of(id)));
+        count++;
+    }
+    playlist_view_end_batch(app);
+    g_string_free(entry_path, TRUE);
+    g_string_free(title, TRUE);
+    g_mapped_file_unref(mapped);
+    mpv_playlist_forget(app);
+    app->session_playlist_saved = count == header.entry_count; // Later saves need only the header
+
+    PlaylistEntry *entry = playlist_set_current(header.current);
+    if (entry) {
+        SessionResume *resume = g_new0(SessionResume, 1);
+        resume->path = g_strdup(entry->path);
+        resume->position = header.position;
+        g_strlcpy(resume->aid, header.aid, sizeof(resume->aid));
+        g_strlcpy(resume->sid, header.sid, sizeof(resume->sid));
+        g_strlcpy(resume->vid, header.vid, sizeof(resume->vid));
+        g_atomic_pointer_set(&app->resume, resume);
+        play_current_entry(app);
+    }
+    *volume = header.volume;
+    g_debug("Session: restored %u entries in %.2f ms", count, (g_get_monotonic_time() - start) / 1000.0);
+    return TRUE;
+}
+
+static void on_file_open_clicked(GtkWidget *button, AppData *app) {
     GtkWidget *dialog;
     GtkFileChooserAction action = GTK_FILE_CHOOSER_ACTION_OPEN;
     gint res;
 
-    dialog = gtk_file_chooser_dialog_new(
-        "Open File", GTK_WINDOW(app->window), action,
-        "_Cancel", GTK_RESPONSE_CANCEL,
-        "_Open", GTK_RESPONSE_ACCEPT,
-        NULL);
+    dialog = gtk_file_chooser_dialog_new(
+        "Open File", GTK_WINDOW(app->window), action,
+        "_Cancel", GTK_RESPONSE_CANCEL,
+        "_Open", GTK_RESPONSE_ACCEPT,
+        NULL);
+
+    // Allow multiple file selection
+    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+
+    res = gtk_dialog_run(GTK_DIALOG(dialog));
+    if (res != GTK_RESPONSE_ACCEPT) {
+        gtk_widget_destroy(dialog);
+        return;
+    }
+
+    // Clear previous video queue if there was one
+    playlist_clear();
+    playlist_view_clear(app);
+    mpv_playlist_forget(app);
+
+    GSList *filenames, *iter;
+    GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
+    filenames = gtk_file_chooser_get_filenames(chooser);
+    iter = filenames;
+
+    // Add the selected files to the video queue
+    playlist_view_begin_batch(app);
+    for (; iter != NULL; iter = iter->next) {
+        char *filename = (char *)iter->data;
+
+        // Add each selected file to the playlist and its view
+        guint id = playlist_append(filename, NULL, -1);
+        playlist_view_append(app, playlist_get(playlist_index_of(id)));
+        
+        g_free(filename);
+         
+    }
+    playlist_view_end_batch(app);
+
+    g_slist_free(filenames);
+
+    // Start the first file right away
+    gtk_widget_destroy(dialog);
+    play_next_in_queue_false(app);
+}
+
+// Frame scaler: nearest, bilinear and area downscale from mpv's rgb0/bgr0 into
+// cairo ARGB32. Every instruction set does the same integer (or identical
+// float) arithmetic, so SIMD output is bit-exact with the scalar reference.
+// Pixels are read as native uint32, which assumes a little-endian host.
+static const char *const scale_mode_names[SCALE_MODE_COUNT] = {"nearest", "bilinear", "area"};
+
+// Video is opaque, so premultiplying is a no-op and only the byte order changes
+static inline uint32_t convert_pixel(uint32_t p, PixelLayout layout) {
+    if (layout == PIXEL_RGB0) {
+        p = ((p & 0xFF) << 16) | (p & 0xFF00) | ((p >> 16) & 0xFF);
+    }
+    return p | 0xFF000000u;
+}
+
+static void scale_scratch_reserve(ScaleScratch *s, int dst_width, int src_width) {
+    if (dst_width > s->columns) {
+        s->x0 = g_renew(int32_t, s->x0, dst_width);
+        s->x1 = g_renew(int32_t, s->x1, dst_width);
+        s->wx = g_renew(int16_t, s->wx, 2 * dst_width);
+        s->rows[0] = g_renew(int16_t, s->rows[0], 4 * dst_width);
+        s->rows[1] = g_renew(int16_t, s->rows[1], 4 * dst_width);
+        s->columns = dst_width;
+    }
+    if (src_width > s->src_columns) {
+        s->colsum = g_renew(uint32_t, s->colsum, 4 * src_width);
+        s->src_columns = src_width;
+    }
+}
 
-    // Allow multiple file selection
-    gtk_file_chooser_set_select_multiple(GTK_FILE_CHOOSER(dialog), TRUE);
+static void scale_scratch_free(ScaleScratch *s) {
+    g_free(s->x0);
+    g_free(s->x1);
+    g_free(s->wx);
+    g_free(s->rows[0]);
+    g_free(s->rows[1]);
+    g_free(s->colsum);
+    memset(s, 0, sizeof(*s));
+}
 
-    res = gtk_dialog_run(GTK_DIALOG(dialog));
-    if (res == GTK_RESPONSE_ACCEPT) {
-        // Clear previous video queue if there was one
-        if (video_queue != NULL) {
-            g_list_free(video_queue);
-            video_queue = NULL;
-            current_video = NULL;
+// Source index under the centre of destination sample i
+static inline int32_t nearest_index(int dst, int src, int i) {
+    return (int32_t)(((int64_t)(2 * i + 1) * src) / (2 * dst));
+}
+
+// Centre-aligned source position of destination sample i, split into the two
+// neighbouring source indices and a 7-bit weight for the second (w0 + w1 == 128)
+static inline void bilinear_index(int dst, int src, int i, int32_t *i0, int32_t *i1, int *w1) {
+    int64_t pos = (((int64_t)(2 * i + 1) * src) << 16) / (2 * dst) - 32768;
+    if (pos < 0) {
+        pos = 0;
+    }
+    int32_t lo = (int32_t)(pos >> 16);
+    int frac = (int)((pos & 0xFFFF) >> 9);
+    if (lo >= src - 1) {
+        lo = src - 1;
+        frac = 0;
+    }
+    *i0 = lo;
+    *i1 = lo < src - 1 ? lo + 1 : lo;
+    *w1 = frac;
+}
+
+// Source range [lo, hi) averaged into destination sample i (at least one sample)
+static inline void area_box(int dst, int src, int i, int32_t *lo, int32_t *hi) {
+    *lo = (int32_t)((int64_t)i * src / dst);
+    *hi = (int32_t)((int64_t)(i + 1) * src / dst);
+    if (*hi <= *lo) {
+        *hi = *lo + 1;
+    }
+}
+
+static void nearest_row_scalar(uint32_t *dst, const uint32_t *src, const int32_t *xmap, int width, PixelLayout layout) {
+    for (int x = 0; x < width; ++x) {
+        dst[x] = convert_pixel(src[xmap[x]], layout);
+    }
+}
+
+static void bilinear_hrow_scalar(int16_t *dst, const uint32_t *src, const int32_t *x0, const int32_t *x1,
+                                 const int16_t *wx, int width) {
+    for (int x = 0; x < width; ++x) {
+        const uint8_t *a = (const uint8_t *)&src[x0[x]];
+        const uint8_t *b = (const uint8_t *)&src[x1[x]];
+        for (int c = 0; c < 4; ++c) {
+            dst[4 * x + c] = (int16_t)(a[c] * wx[2 * x] + b[c] * wx[2 * x + 1]);
+        }
+    }
+}
+
+static void bilinear_vrow_scalar(uint32_t *dst, const int16_t *top, const int16_t *bottom, int wy1, int width,
+                                 PixelLayout layout) {
+    int wy0 = 128 - wy1;
+    for (int x = 0; x < width; ++x) {
+        uint32_t p = 0;
+        for (int c = 0; c < 4; ++c) {
+            uint32_t v = (uint32_t)(top[4 * x + c] * wy0 + bottom[4 * x + c] * wy1 + 8192) >> 14;
+            p |= v << (8 * c);
+        }
+        dst[x] = convert_pixel(p, layout);
+    }
+}
+
+static void area_accumulate_scalar(uint32_t *colsum, const uint8_t *src, int src_width) {
+    for (int i = 0; i < 4 * src_width; ++i) {
+        colsum[i] += src[i];
+    }
+}
+
+static void area_reduce_scalar(uint32_t *dst, const uint32_t *colsum, const int32_t *x0, const int32_t *x1,
+                               int box_height, int width, PixelLayout layout) {
+    for (int x = 0; x < width; ++x) {
+        float inv = 1.0f / (float)((x1[x] - x0[x]) * box_height);
+        uint32_t p = 0;
+        for (int c = 0; c < 4; ++c) {
+            uint32_t sum = 0;
+            for (int col = x0[x]; col < x1[x]; ++col) {
+                sum += colsum[4 * col + c];
+            }
+            uint32_t v = (uint32_t)((float)sum * inv + 0.5f);
+            p |= v << (8 * c);
+        }
+        dst[x] = convert_pixel(p, layout);
+    }
+}
+
+static const ScalerImpl scaler_scalar = {
+    "scalar",
+    nearest_row_scalar,
+    bilinear_hrow_scalar,
+    bilinear_vrow_scalar,
+    area_accumulate_scalar,
+    area_reduce_scalar
+};
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse2")))
+static inline __m128i convert4_sse2(__m128i p, PixelLayout layout) {
+    if (layout == PIXEL_RGB0) {
+        __m128i low = _mm_set1_epi32(0xFF);
+        __m128i r = _mm_and_si128(p, low);
+        __m128i g = _mm_and_si128(p, _mm_set1_epi32(0xFF00));
+        __m128i b = _mm_and_si128(_mm_srli_epi32(p, 16), low);
+        p = _mm_or_si128(_mm_or_si128(_mm_slli_epi32(r, 16), g), b);
+    }
+    return _mm_or_si128(p, _mm_set1_epi32((int)0xFF000000u));
+}
+
+__attribute__((target("sse2")))
+static void nearest_row_sse2(uint32_t *dst, const uint32_t *src, const int32_t *xmap, int width, PixelLayout layout) {
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i p = _mm_setr_epi32((int)src[xmap[x]], (int)src[xmap[x + 1]],
+                                   (int)src[xmap[x + 2]], (int)src[xmap[x + 3]]);
+        _mm_storeu_si128((__m128i *)(dst + x), convert4_sse2(p, layout));
+    }
+    nearest_row_scalar(dst + x, src, xmap + x, width - x, layout);
+}
+
+// Two destination pixels per step: interleave each (a, b) source pair per
+// channel and let pmaddwd apply (w0, w1)
+__attribute__((target("sse2")))
+static void bilinear_hrow_sse2(int16_t *dst, const uint32_t *src, const int32_t *x0, const int32_t *x1,
+                               const int16_t *wx, int width) {
+    const __m128i zero = _mm_setzero_si128();
+    int x = 0;
+    for (; x + 2 <= width; x += 2) {
+        __m128i a = _mm_setr_epi32((int)src[x0[x]], (int)src[x0[x + 1]], 0, 0);
+        __m128i b = _mm_setr_epi32((int)src[x1[x]], (int)src[x1[x + 1]], 0, 0);
+        __m128i ab = _mm_unpacklo_epi8(a, b);
+        int32_t w0, w1;
+        memcpy(&w0, wx + 2 * x, sizeof(w0));
+        memcpy(&w1, wx + 2 * x + 2, sizeof(w1));
+        __m128i s0 = _mm_madd_epi16(_mm_unpacklo_epi8(ab, zero), _mm_set1_epi32(w0));
+        __m128i s1 = _mm_madd_epi16(_mm_unpackhi_epi8(ab, zero), _mm_set1_epi32(w1));
+        _mm_storeu_si128((__m128i *)(dst + 4 * x), _mm_packs_epi32(s0, s1));
+    }
+    bilinear_hrow_scalar(dst + 4 * x, src, x0 + x, x1 + x, wx + 2 * x, width - x);
+}
+
+__attribute__((target("sse2")))
+static void bilinear_vrow_sse2(uint32_t *dst, const int16_t *top, const int16_t *bottom, int wy1, int width,
+                               PixelLayout layout) {
+    const __m128i wy = _mm_set1_epi32((int)(((uint32_t)wy1 << 16) | (uint32_t)(128 - wy1)));
+    const __m128i round = _mm_set1_epi32(8192);
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m128i t0 = _mm_loadu_si128((const __m128i *)(top + 4 * x));
+        __m128i t1 = _mm_loadu_si128((const __m128i *)(top + 4 * x + 8));
+        __m128i b0 = _mm_loadu_si128((const __m128i *)(bottom + 4 * x));
+        __m128i b1 = _mm_loadu_si128((const __m128i *)(bottom + 4 * x + 8));
+        __m128i r0 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t0, b0), wy), round), 14);
+        __m128i r1 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t0, b0), wy), round), 14);
+        __m128i r2 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(t1, b1), wy), round), 14);
+        __m128i r3 = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(t1, b1), wy), round), 14);
+        __m128i p = _mm_packus_epi16(_mm_packs_epi32(r0, r1), _mm_packs_epi32(r2, r3));
+        _mm_storeu_si128((__m128i *)(dst + x), convert4_sse2(p, layout));
+    }
+    bilinear_vrow_scalar(dst + x, top + 4 * x, bottom + 4 * x, wy1, width - x, layout);
+}
+
+__attribute__((target("sse2")))
+static void area_accumulate_sse2(uint32_t *colsum, const uint8_t *src, int src_width) {
+    const __m128i zero = _mm_setzero_si128();
+    int n = 4 * src_width;
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *sum = (__m128i *)(colsum + i);
+        _mm_storeu_si128(sum, _mm_add_epi32(_mm_loadu_si128(sum), _mm_unpacklo_epi16(lo, zero)));
+        _mm_storeu_si128(sum + 1, _mm_add_epi32(_mm_loadu_si128(sum + 1), _mm_unpackhi_epi16(lo, zero)));
+        _mm_storeu_si128(sum + 2, _mm_add_epi32(_mm_loadu_si128(sum + 2), _mm_unpacklo_epi16(hi, zero)));
+        _mm_storeu_si128(sum + 3, _mm_add_epi32(_mm_loadu_si128(sum + 3), _mm_unpackhi_epi16(hi, zero)));
+    }
+    for (; i < n; ++i) {
+        colsum[i] += src[i];
+    }
+}
+
+// One pixel's four channel sums fill a vector, so this also serves AVX2
+__attribute__((target("sse2")))
+static void area_reduce_sse2(uint32_t *dst, const uint32_t *colsum, const int32_t *x0, const int32_t *x1,
+                             int box_height, int width, PixelLayout layout) {
+    const __m128 half = _mm_set1_ps(0.5f);
+    for (int x = 0; x < width; ++x) {
+        __m128i sum = _mm_setzero_si128();
+        for (int col = x0[x]; col < x1[x]; ++col) {
+            sum = _mm_add_epi32(sum, _mm_loadu_si128((const __m128i *)(colsum + 4 * col)));
+        }
+        float inv = 1.0f / (float)((x1[x] - x0[x]) * box_height);
+        __m128 f = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(sum), _mm_set1_ps(inv)), half);
+        __m128i v = _mm_cvttps_epi32(f);
+        v = _mm_packus_epi16(_mm_packs_epi32(v, v), v);
+        dst[x] = convert_pixel((uint32_t)_mm_cvtsi128_si32(v), layout);
+    }
+}
+
+static const ScalerImpl scaler_sse2 = {
+    "sse2",
+    nearest_row_sse2,
+    bilinear_hrow_sse2,
+    bilinear_vrow_sse2,
+    area_accumulate_sse2,
+    area_reduce_sse2
+};
+
+__attribute__((target("avx2")))
+static inline __m256i convert8_avx2(__m256i p, PixelLayout layout) {
+    if (layout == PIXEL_RGB0) {
+        const __m256i swap_rb = _mm256_setr_epi8(2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1,
+                                                 2, 1, 0, -1, 6, 5, 4, -1, 10, 9, 8, -1, 14, 13, 12, -1);
+        p = _mm256_shuffle_epi8(p, swap_rb);
+    }
+    return _mm256_or_si256(p, _mm256_set1_epi32((int)0xFF000000u));
+}
+
+__attribute__((target("avx2")))
+static void nearest_row_avx2(uint32_t *dst, const uint32_t *src, const int32_t *xmap, int width, PixelLayout layout) {
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i idx = _mm256_loadu_si256((const __m256i *)(xmap + x));
+        __m256i p = _mm256_i32gather_epi32((const int *)src, idx, 4);
+        _mm256_storeu_si256((__m256i *)(dst + x), convert8_avx2(p, layout));
+    }
+    nearest_row_scalar(dst + x, src, xmap + x, width - x, layout);
+}
+
+// Same scheme as the SSE2 version; each 128-bit lane handles two pixels
+__attribute__((target("avx2")))
+static void bilinear_hrow_avx2(int16_t *dst, const uint32_t *src, const int32_t *x0, const int32_t *x1,
+                               const int16_t *wx, int width) {
+    const __m256i zero = _mm256_setzero_si256();
+    int x = 0;
+    for (; x + 4 <= width; x += 4) {
+        __m256i a = _mm256_setr_epi32((int)src[x0[x]], (int)src[x0[x + 1]], 0, 0,
+                                      (int)src[x0[x + 2]], (int)src[x0[x + 3]], 0, 0);
+        __m256i b = _mm256_setr_epi32((int)src[x1[x]], (int)src[x1[x + 1]], 0, 0,
+                                      (int)src[x1[x + 2]], (int)src[x1[x + 3]], 0, 0);
+        __m256i ab = _mm256_unpacklo_epi8(a, b);
+        int32_t w[4];
+        memcpy(w, wx + 2 * x, sizeof(w));
+        __m256i w_even = _mm256_setr_epi32(w[0], w[0], w[0], w[0], w[2], w[2], w[2], w[2]);
+        __m256i w_odd = _mm256_setr_epi32(w[1], w[1], w[1], w[1], w[3], w[3], w[3], w[3]);
+        __m256i s_even = _mm256_madd_epi16(_mm256_unpacklo_epi8(ab, zero), w_even);
+        __m256i s_odd = _mm256_madd_epi16(_mm256_unpackhi_epi8(ab, zero), w_odd);
+        _mm256_storeu_si256((__m256i *)(dst + 4 * x), _mm256_packs_epi32(s_even, s_odd));
+    }
+    bilinear_hrow_scalar(dst + 4 * x, src, x0 + x, x1 + x, wx + 2 * x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void bilinear_vrow_avx2(uint32_t *dst, const int16_t *top, const int16_t *bottom, int wy1, int width,
+                               PixelLayout layout) {
+    const __m256i wy = _mm256_set1_epi32((int)(((uint32_t)wy1 << 16) | (uint32_t)(128 - wy1)));
+    const __m256i round = _mm256_set1_epi32(8192);
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m256i t0 = _mm256_loadu_si256((const __m256i *)(top + 4 * x));
+        __m256i t1 = _mm256_loadu_si256((const __m256i *)(top + 4 * x + 16));
+        __m256i b0 = _mm256_loadu_si256((const __m256i *)(bottom + 4 * x));
+        __m256i b1 = _mm256_loadu_si256((const __m256i *)(bottom + 4 * x + 16));
+        __m256i r0 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(t0, b0), wy), round), 14);
+        __m256i r1 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(t0, b0), wy), round), 14);
+        __m256i r2 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(t1, b1), wy), round), 14);
+        __m256i r3 = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(t1, b1), wy), round), 14);
+        __m256i p = _mm256_packus_epi16(_mm256_packs_epi32(r0, r1), _mm256_packs_epi32(r2, r3));
+        p = _mm256_permute4x64_epi64(p, _MM_SHUFFLE(3, 1, 2, 0)); // Undo the per-lane packing order
+        _mm256_storeu_si256((__m256i *)(dst + x), convert8_avx2(p, layout));
+    }
+    bilinear_vrow_scalar(dst + x, top + 4 * x, bottom + 4 * x, wy1, width - x, layout);
+}
+
+__attribute__((target("avx2")))
+static void area_accumulate_avx2(uint32_t *colsum, const uint8_t *src, int src_width) {
+    int n = 4 * src_width;
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(src + i)));
+        __m256i *sum = (__m256i *)(colsum + i);
+        _mm256_storeu_si256(sum, _mm256_add_epi32(_mm256_loadu_si256(sum), v));
+    }
+    for (; i < n; ++i) {
+        colsum[i] += src[i];
+    }
+}
+
+static const ScalerImpl scaler_avx2 = {
+    "avx2",
+    nearest_row_avx2,
+    bilinear_hrow_avx2,
+    bilinear_vrow_avx2,
+    area_accumulate_avx2,
+    area_reduce_sse2
+};
+#endif
+
+// Best implementation this CPU can run
+static const ScalerImpl *select_scaler(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &scaler_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return &scaler_sse2;
+    }
+#endif
+    return &scaler_scalar;
+}
+
+// Bilinear keeps the last two filtered source rows; when upscaling most
+// destination rows reuse both
+static const int16_t *bilinear_source_row(const ScalerImpl *impl, const ScaleJob *job, int y, int keep) {
+    ScaleScratch *s = job->scratch;
+    for (int i = 0; i < 2; ++i) {
+        if (s->row_y[i] == y) {
+            return s->rows[i];
+        }
+    }
+    int slot = s->row_y[0] == keep ? 1 : 0;
+    const uint32_t *src = (const uint32_t *)(job->src + (size_t)y * job->src_stride);
+    impl->bilinear_hrow(s->rows[slot], src, s->x0, s->x1, s->wx, job->dst_width);
+    s->row_y[slot] = y;
+    return s->rows[slot];
+}
+
+static void scale_frame(const ScalerImpl *impl, ScaleMode mode, const ScaleJob *job) {
+    ScaleScratch *s = job->scratch;
+    int dw = job->dst_width, dh = job->dst_height;
+    int sw = job->src_width, sh = job->src_height;
+    if (dw <= 0 || dh <= 0 || sw <= 0 || sh <= 0) {
+        return;
+    }
+    scale_scratch_reserve(s, dw, sw);
+
+    switch (mode) {
+        case SCALE_NEAREST:
+            for (int x = 0; x < dw; ++x) {
+                s->x0[x] = nearest_index(dw, sw, x);
+            }
+            for (int y = 0; y < dh; ++y) {
+                const uint32_t *src = (const uint32_t *)(job->src + (size_t)nearest_index(dh, sh, y) * job->src_stride);
+                impl->nearest_row((uint32_t *)(job->dst + (size_t)y * job->dst_stride), src, s->x0, dw, job->layout);
+            }
+            break;
+        case SCALE_BILINEAR:
+            for (int x = 0; x < dw; ++x) {
+                int w1;
+                bilinear_index(dw, sw, x, &s->x0[x], &s->x1[x], &w1);
+                s->wx[2 * x] = (int16_t)(128 - w1);
+                s->wx[2 * x + 1] = (int16_t)w1;
+            }
+            s->row_y[0] = s->row_y[1] = -1;
+            for (int y = 0; y < dh; ++y) {
+                int32_t y0, y1;
+                int wy1;
+                bilinear_index(dh, sh, y, &y0, &y1, &wy1);
+                const int16_t *top = bilinear_source_row(impl, job, y0, y1);
+                const int16_t *bottom = bilinear_source_row(impl, job, y1, y0);
+                impl->bilinear_vrow((uint32_t *)(job->dst + (size_t)y * job->dst_stride), top, bottom, wy1, dw,
+                                    job->layout);
+            }
+            break;
+        case SCALE_AREA:
+            for (int x = 0; x < dw; ++x) {
+                area_box(dw, sw, x, &s->x0[x], &s->x1[x]);
+            }
+            for (int y = 0; y < dh; ++y) {
+                int32_t y0, y1;
+                area_box(dh, sh, y, &y0, &y1);
+                memset(s->colsum, 0, sizeof(uint32_t) * 4 * sw);
+                for (int sy = y0; sy < y1; ++sy) {
+                    impl->area_accumulate(s->colsum, job->src + (size_t)sy * job->src_stride, sw);
+                }
+                impl->area_reduce((uint32_t *)(job->dst + (size_t)y * job->dst_stride), s->colsum, s->x0, s->x1,
+                                  y1 - y0, dw, job->layout);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// --bench-scaler: check every SIMD path against the scalar reference on
+// awkward sizes, then report frames per second for 4K -> 1080p
+static int run_scaler_benchmark(void) {
+    const ScalerImpl *impls[3];
+    int impl_count = 0;
+    impls[impl_count++] = &scaler_scalar;
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        impls[impl_count++] = &scaler_sse2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        impls[impl_count++] = &scaler_avx2;
+    }
+#endif
+    printf("Scaler: using %s\n", select_scaler()->name);
+
+    const int sw = 3840, sh = 2160;
+    int src_stride = sw * 4 + 64; // Padded rows, like mpv's
+    uint8_t *src = g_malloc((size_t)src_stride * sh);
+    GRand *rand = g_rand_new_with_seed(12345);
+    for (size_t i = 0; i < (size_t)src_stride * sh; ++i) {
+        src[i] = (uint8_t)g_rand_int(rand);
+    }
+    g_rand_free(rand);
+
+    static const int sizes[][4] = { // src w, src h, dst w, dst h
+        {3840, 2160, 1920, 1080}, {3840, 2160, 1277, 719}, {1920, 1080, 2563, 1441},
+        {97, 61, 31, 17}, {7, 5, 33, 29}, {1, 1, 5, 3}, {640, 360, 640, 360}
+    };
+    int failures = 0;
+    ScaleScratch scratch = {0};
+    for (size_t t = 0; t < G_N_ELEMENTS(sizes); ++t) {
+        int dw = sizes[t][2], dh = sizes[t][3];
+        int dst_stride = dw * 4;
+        uint8_t *expected = g_malloc((size_t)dst_stride * dh);
+        uint8_t *actual = g_malloc((size_t)dst_stride * dh);
+        for (int mode = 0; mode < SCALE_MODE_COUNT; ++mode) {
+            for (int layout = PIXEL_BGR0; layout <= PIXEL_RGB0; ++layout) {
+                ScaleJob job = {src, sizes[t][0], sizes[t][1], src_stride, expected, dw, dh, dst_stride,
+                                (PixelLayout)layout, &scratch};
+                scale_frame(&scaler_scalar, (ScaleMode)mode, &job);
+                for (int i = 1; i < impl_count; ++i) {
+                    job.dst = actual;
+                    scale_frame(impls[i], (ScaleMode)mode, &job);
+                    job.dst = expected;
+                    if (memcmp(expected, actual, (size_t)dst_stride * dh) != 0) {
+                        fprintf(stderr, "Scaler: %s %s %dx%d -> %dx%d differs from scalar\n", impls[i]->name,
+                                scale_mode_names[mode], sizes[t][0], sizes[t][1], dw, dh);
+                        failures++;
+                    }
+                }
+            }
+        }
+        g_free(expected);
+        g_free(actual);
+    }
+    printf("Scaler: correctness %s\n", failures ? "FAILED" : "ok");
+
+    const int dw = 1920, dh = 1080;
+    uint8_t *dst = g_malloc((size_t)dw * 4 * dh);
+    for (int mode = 0; mode < SCALE_MODE_COUNT; ++mode) {
+        for (int i = 0; i < impl_count; ++i) {
+            ScaleJob job = {src, sw, sh, src_stride, dst, dw, dh, dw * 4, PIXEL_RGB0, &scratch};
+            int frames = 0;
+            gint64 start = g_get_monotonic_time();
+            gint64 elapsed;
+            do {
+                scale_frame(impls[i], (ScaleMode)mode, &job);
+                frames++;
+                elapsed = g_get_monotonic_time() - start;
+            } while (elapsed < G_USEC_PER_SEC / 2);
+            printf("Scaler: %-8s %-6s 3840x2160 -> 1920x1080: %.1f fps\n", scale_mode_names[mode], impls[i]->name,
+                   frames * (double)G_USEC_PER_SEC / elapsed);
+        }
+    }
+    g_free(dst);
+    g_free(src);
+    scale_scratch_free(&scratch);
+    return failures ? 1 : 0;
+}
+
+// Software render path. mpv renders "bgr0" (cairo's RGB24 layout on
+// little-endian) straight into pool slots on render_thread; on_draw_frame
+// paints the newest one. Nothing is allocated per frame.
+static const cairo_user_data_key_t frame_memory_key;
+
+static cairo_surface_t *frame_slot_new(int width, int height, int scale, cairo_format_t format) {
+    int stride = cairo_format_stride_for_width(format, width);
+    stride = (stride + FRAME_STRIDE_ALIGN - 1) & ~(FRAME_STRIDE_ALIGN - 1);
+    void *data = NULL;
+    if (posix_memalign(&data, FRAME_STRIDE_ALIGN, (size_t)stride * height) != 0) {
+        fprintf(stderr, "Failed to allocate a %dx%d frame buffer\n", width, height);
+        return NULL;
+    }
+    memset(data, 0, (size_t)stride * height); // Black until the first frame
+    cairo_surface_t *surface = cairo_image_surface_create_for_data(data, format, width, height, stride);
+    // The memory lives as long as the surface, even if on_draw_frame still holds it after a resize
+    cairo_surface_set_user_data(surface, &frame_memory_key, data, free);
+    cairo_surface_set_device_scale(surface, scale, scale); // Painted 1:1 onto a HiDPI window
+    return surface;
+}
+
+// Called with pool->lock held
+static void frame_pool_reallocate(FramePool *pool) {
+    for (int i = 0; i < FRAME_POOL_SIZE; ++i) {
+        if (pool->slots[i]) {
+            cairo_surface_destroy(pool->slots[i]);
+            pool->slots[i] = NULL;
+        }
+        if (pool->width > 0 && pool->height > 0) {
+            pool->slots[i] = frame_slot_new(pool->width, pool->height, pool->scale, pool->format);
+        }
+    }
+    pool->latest = -1;
+    pool->drawing = -1;
+}
+
+static gboolean on_frame_ready_idle(gpointer user_data) {
+    AppData *app = (AppData *)user_data;
+    g_atomic_int_set(&app->frames.redraw_queued, 0);
+    gtk_widget_queue_draw(app->drawing_area);
+    return G_SOURCE_REMOVE;
+}
+
+static void render_into_buffer(AppData *app, void *data, int width, int height, size_t stride) {
+    int size[2] = {width, height};
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_SW_SIZE, size},
+        {MPV_RENDER_PARAM_SW_FORMAT, "bgr0"},
+        {MPV_RENDER_PARAM_SW_STRIDE, &stride},
+        {MPV_RENDER_PARAM_SW_POINTER, data},
+        {MPV_RENDER_PARAM_INVALID, NULL}
+    };
+    int err = mpv_render_context_render(app->render_ctx, params);
+    if (err < 0) {
+        fprintf(stderr, "MPV: render failed: %s\n", mpv_error_string(err));
+    }
+}
+
+// Opaque black around the w x h picture placed at (x, y)
+static void fill_letterbox(uint8_t *data, int stride, int width, int height, int x, int y, int w, int h) {
+    for (int row = 0; row < height; ++row) {
+        uint32_t *line = (uint32_t *)(data + (size_t)row * stride);
+        if (row < y || row >= y + h) {
+            for (int col = 0; col < width; ++col) {
+                line[col] = 0xFF000000u;
+            }
+            continue;
+        }
+        for (int col = 0; col < x; ++col) {
+            line[col] = 0xFF000000u;
+        }
+        for (int col = x + w; col < width; ++col) {
+            line[col] = 0xFF000000u;
+        }
+    }
+}
+
+// Largest w x h with the aspect of src_w x src_h that fits dst_w x dst_h, centred at (x, y)
+static void fit_rect(int src_w, int src_h, int dst_w, int dst_h, int *x, int *y, int *w, int *h) {
+    double fit = MIN((double)dst_w / src_w, (double)dst_h / src_h);
+    *w = CLAMP((int)(src_w * fit + 0.5), 1, dst_w);
+    *h = CLAMP((int)(src_h * fit + 0.5), 1, dst_h);
+    *x = (dst_w - *w) / 2;
+    *y = (dst_h - *h) / 2;
+}
+
+// mpv renders the frame at its display size, our scaler fits it into the slot
+static gboolean render_scaled(AppData *app, cairo_surface_t *target) {
+    FramePool *pool = &app->frames;
+    PlayerSnapshot snap;
+    player_state_read(&app->state, &snap);
+    int vw = snap.video_width, vh = snap.video_height;
+    if (vw <= 0 || vh <= 0) {
+        return FALSE;
+    }
+    if (vw != pool->source_width || vh != pool->source_height) {
+        free(pool->source);
+        pool->source_stride = (vw * 4 + FRAME_STRIDE_ALIGN - 1) & ~(FRAME_STRIDE_ALIGN - 1);
+        if (posix_memalign((void **)&pool->source, FRAME_STRIDE_ALIGN, (size_t)pool->source_stride * vh) != 0) {
+            pool->source = NULL;
+            pool->source_width = pool->source_height = 0;
+            return FALSE;
+        }
+        pool->source_width = vw;
+        pool->source_height = vh;
+    }
+    render_into_buffer(app, pool->source, vw, vh, pool->source_stride);
+
+    int width = cairo_image_surface_get_width(target);
+    int height = cairo_image_surface_get_height(target);
+    int stride = cairo_image_surface_get_stride(target);
+    int x, y, w, h;
+    fit_rect(vw, vh, width, height, &x, &y, &w, &h); // Keep the aspect ratio
+    uint8_t *data = cairo_image_surface_get_data(target);
+    fill_letterbox(data, stride, width, height, x, y, w, h);
+    ScaleJob job = {pool->source, vw, vh, pool->source_stride,
+                    data + (size_t)y * stride + (size_t)x * 4, w, h, stride, PIXEL_BGR0, &pool->scratch};
+    scale_frame(pool->scaler, (ScaleMode)pool->scale_mode, &job);
+    return TRUE;
+}
+
+static void render_into_slot(AppData *app, cairo_surface_t *target) {
+    cairo_surface_flush(target);
+    if (app->frames.scale_mode < 0 || !render_scaled(app, target)) {
+        render_into_buffer(app, cairo_image_surface_get_data(target), cairo_image_surface_get_width(target),
+                           cairo_image_surface_get_height(target), cairo_image_surface_get_stride(target));
+    }
+    cairo_surface_mark_dirty(target);
+}
+
+// The only thread that calls into the render context while it is running
+static gpointer render_thread(gpointer user_data) {
+    AppData *app = (AppData *)user_data;
+    FramePool *pool = &app->frames;
+
+    g_mutex_lock(&pool->lock);
+    while (!pool->quit) {
+        if (!pool->update_pending && !pool->resized) {
+            g_cond_wait(&pool->wake, &pool->lock);
+            continue;
+        }
+        gboolean resized = pool->resized;
+        pool->update_pending = FALSE;
+        pool->resized = FALSE;
+        if (resized) {
+            frame_pool_reallocate(pool);
+        }
+        int slot = 0; // Whichever slot is neither on screen nor about to be
+        while (slot == pool->latest || slot == pool->drawing) {
+            slot++;
+        }
+        cairo_surface_t *target = pool->slots[slot] ? cairo_surface_reference(pool->slots[slot]) : NULL;
+        g_mutex_unlock(&pool->lock);
+
+        // Must run after every update callback, even if nothing gets drawn
+        uint64_t flags = mpv_render_context_update(app->render_ctx);
+        gboolean rendered = FALSE;
+        if (target && ((flags & MPV_RENDER_UPDATE_FRAME) || resized)) {
+            render_into_slot(app, target);
+            rendered = TRUE;
+        }
+
+        g_mutex_lock(&pool->lock);
+        if (rendered && pool->slots[slot] == target) { // Not reallocated meanwhile
+            pool->latest = slot;
+            if (g_atomic_int_compare_and_exchange(&pool->redraw_queued, 0, 1)) {
+                g_idle_add(on_frame_ready_idle, app);
+            }
+        }
+        if (target) {
+            cairo_surface_destroy(target);
+        }
+    }
+    g_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// Called by mpv from its own threads; mpv API must not be used here
+static void on_render_update(void *user_data) {
+    FramePool *pool = &((AppData *)user_data)->frames;
+    g_mutex_lock(&pool->lock);
+    pool->update_pending = TRUE;
+    g_cond_signal(&pool->wake);
+    g_mutex_unlock(&pool->lock);
+}
+
+// The pool follows the drawing area's allocation in device pixels, so mpv
+// renders at full resolution on a scaled (HiDPI) output; nothing else
+// resizes it
+static void frame_pool_follow_widget(AppData *app, GtkWidget *widget) {
+    FramePool *pool = &app->frames;
+    int scale = gtk_widget_get_scale_factor(widget);
+    int width = gtk_widget_get_allocated_width(widget) * scale;
+    int height = gtk_widget_get_allocated_height(widget) * scale;
+    g_mutex_lock(&pool->lock);
+    if (width != pool->width || height != pool->height || scale != pool->scale) {
+        pool->width = width;
+        pool->height = height;
+        pool->scale = scale;
+        pool->resized = TRUE;
+        g_cond_signal(&pool->wake);
+    }
+    g_mutex_unlock(&pool->lock);
+}
+
+static void on_drawing_area_size_allocate(GtkWidget *widget, GdkRectangle *allocation, AppData *app) {
+    frame_pool_follow_widget(app, widget);
+}
+
+// Moved to an output with another scale: same allocation, more or fewer pixels
+static void on_drawing_area_scale_changed(GtkWidget *widget, GParamSpec *pspec, AppData *app) {
+    frame_pool_follow_widget(app, widget);
+}
+
+static gboolean create_sw_render_context(AppData *app) {
+    FramePool *pool = &app->frames;
+    g_mutex_init(&pool->lock);
+    g_cond_init(&pool->wake);
+    pool->latest = -1;
+    pool->drawing = -1;
+    pool->format = pool->scale_mode >= 0 ? CAIRO_FORMAT_ARGB32 : CAIRO_FORMAT_RGB24;
+    pool->scaler = select_scaler();
+    if (pool->scale_mode >= 0) {
+        printf("Scaler: %s, %s\n", scale_mode_names[pool->scale_mode], pool->scaler->name);
+    }
+
+    mpv_render_param params[] = {
+        {MPV_RENDER_PARAM_API_TYPE, MPV_RENDER_API_TYPE_SW},
+        {MPV_RENDER_PARAM_INVALID, NULL}
+    };
+    int err = mpv_render_context_create(&app->render_ctx, app->mpv, params);
+    if (err < 0) {
+        fprintf(stderr, "MPV: could not create software render context: %s\n", mpv_error_string(err));
+        app->render_ctx = NULL;
+        g_cond_clear(&pool->wake);
+        g_mutex_clear(&pool->lock);
+        return FALSE;
+    }
+    mpv_render_context_set_update_callback(app->render_ctx, on_render_update, app);
+    pool->thread = g_thread_new("render_thread", render_thread, app);
+    return TRUE;
+}
+
+// Stops the render thread and frees the render context (before mpv_destroy)
+static void destroy_sw_render_context(AppData *app) {
+    FramePool *pool = &app->frames;
+    g_mutex_lock(&pool->lock);
+    pool->quit = TRUE;
+    g_cond_signal(&pool->wake);
+    g_mutex_unlock(&pool->lock);
+    g_thread_join(pool->thread);
+
+    mpv_render_context_free(app->render_ctx);
+    app->render_ctx = NULL;
+    for (int i = 0; i < FRAME_POOL_SIZE; ++i) {
+        if (pool->slots[i]) {
+            cairo_surface_destroy(pool->slots[i]);
+        }
+    }
+    free(pool->source);
+    scale_scratch_free(&pool->scratch);
+    g_cond_clear(&pool->wake);
+    g_mutex_clear(&pool->lock);
+}
+
+// Draw handler for the software path, connected instead of on_draw
+static gboolean on_draw_frame(GtkWidget *widget, cairo_t *cr, AppData *app) {
+    FramePool *pool = &app->frames;
+    cairo_surface_t *frame = NULL;
+    g_mutex_lock(&pool->lock);
+    if (pool->latest >= 0) {
+        pool->drawing = pool->latest;
+        frame = cairo_surface_reference(pool->slots[pool->latest]);
+    }
+    g_mutex_unlock(&pool->lock);
+
+    if (frame) {
+        cairo_set_source_surface(cr, frame, 0, 0);
+    } else {
+        cairo_set_source_rgb(cr, 0, 0, 0);
+    }
+    cairo_paint(cr);
+
+    if (frame) {
+        g_mutex_lock(&pool->lock);
+        pool->drawing = -1;
+        g_mutex_unlock(&pool->lock);
+        cairo_surface_destroy(frame);
+    }
+    return TRUE;
+}
+
+// Seek-bar previews. A background thread with its own headless mpv seeks to
+// keyframes at fixed intervals, grabs each frame with screenshot-raw, shrinks
+// it with the frame scaler and packs it into a sprite atlas. Atlases are
+// cached as PNG, keyed by path, size and mtime.
+#define THUMB_WIDTH 160
+#define THUMB_HEIGHT 90
+#define THUMB_COLUMNS 10
+#define THUMB_MAX_COUNT 200
+#define THUMB_MIN_INTERVAL 10.0 // Seconds between thumbnails on short files
+
+typedef struct {
+    GMutex lock;
+    GCond wake;
+    GThread *thread;
+    gint quit;
+    mpv_handle *mpv;         // Worker's handle, woken on shutdown
+    char *wanted;            // File previews are wanted for, NULL if none
+    guint wanted_serial;     // Bumped per request so stale work is abandoned
+    // Published for the GTK side, only replaced under lock
+    cairo_surface_t *atlas;
+    double interval;
+    int count;
+    char *cache_dir;
+} Thumbnailer;
+
+static Thumbnailer thumbs;
+
+static gboolean thumbnail_request_stale(guint serial) {
+    g_mutex_lock(&thumbs.lock);
+    gboolean stale = serial != thumbs.wanted_serial || g_atomic_int_get(&thumbs.quit);
+    g_mutex_unlock(&thumbs.lock);
+    return stale;
+}
+
+// Grab the current frame and scale it into atlas cell index
+static gboolean grab_thumbnail(mpv_handle *mpv, cairo_surface_t *atlas, int index, ScaleScratch *scratch) {
+    mpv_node result;
+    const char *cmd[] = {"screenshot-raw", "video", NULL};
+    if (mpv_command_ret(mpv, cmd, &result) < 0) {
+        return FALSE;
+    }
+    gboolean ok = FALSE;
+    if (result.format == MPV_FORMAT_NODE_MAP) {
+        mpv_node *w = mpv_node_list_find_property(result.u.list, "w");
+        mpv_node *h = mpv_node_list_find_property(result.u.list, "h");
+        mpv_node *stride = mpv_node_list_find_property(result.u.list, "stride");
+        mpv_node *format = mpv_node_list_find_property(result.u.list, "format");
+        mpv_node *data = mpv_node_list_find_property(result.u.list, "data");
+        if (w && h && stride && data && w->format == MPV_FORMAT_INT64 && h->format == MPV_FORMAT_INT64 &&
+            stride->format == MPV_FORMAT_INT64 && data->format == MPV_FORMAT_BYTE_ARRAY) {
+            gboolean rgb = format && format->format == MPV_FORMAT_STRING && strcmp(format->u.string, "rgb0") == 0;
+            int cell_x = (index % THUMB_COLUMNS) * THUMB_WIDTH;
+            int cell_y = (index / THUMB_COLUMNS) * THUMB_HEIGHT;
+            int x, y, fw, fh;
+            fit_rect((int)w->u.int64, (int)h->u.int64, THUMB_WIDTH, THUMB_HEIGHT, &x, &y, &fw, &fh);
+            int atlas_stride = cairo_image_surface_get_stride(atlas);
+            uint8_t *dst = cairo_image_surface_get_data(atlas) + (size_t)(cell_y + y) * atlas_stride +
+                           (size_t)(cell_x + x) * 4;
+            ScaleJob job = {data->u.ba->data, (int)w->u.int64, (int)h->u.int64, (int)stride->u.int64,
+                            dst, fw, fh, atlas_stride, rgb ? PIXEL_RGB0 : PIXEL_BGR0, scratch};
+            scale_frame(select_scaler(), SCALE_AREA, &job);
+            ok = TRUE;
+        }
+    }
+    mpv_free_node_contents(&result);
+    return ok;
+}
+
+static cairo_surface_t *generate_thumbnails(mpv_handle *mpv, const char *path, guint serial,
+                                            double *interval, int *count) {
+    static const mpv_event_id file_events[] = {MPV_EVENT_FILE_LOADED, MPV_EVENT_END_FILE, MPV_EVENT_NONE};
+    static const mpv_event_id seek_events[] = {MPV_EVENT_PLAYBACK_RESTART, MPV_EVENT_END_FILE, MPV_EVENT_NONE};
+    const char *load[] = {"loadfile", path, NULL};
+    if (mpv_command(mpv, load) < 0) {
+        return NULL;
+    }
+    mpv_event_id got = wait_for_mpv_event(mpv, file_events, PROBE_TIMEOUT, &thumbs.quit);
+    cairo_surface_t *atlas = NULL;
+    double duration = 0;
+    if (got == MPV_EVENT_FILE_LOADED &&
+        mpv_get_property(mpv, "duration", MPV_FORMAT_DOUBLE, &duration) >= 0 && duration > 0) {
+        *interval = MAX(THUMB_MIN_INTERVAL, duration / THUMB_MAX_COUNT);
+        *count = MAX(1, (int)(duration / *interval));
+        int rows = (*count + THUMB_COLUMNS - 1) / THUMB_COLUMNS;
+        atlas = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, THUMB_COLUMNS * THUMB_WIDTH, rows * THUMB_HEIGHT);
+        ScaleScratch scratch = {0};
+        cairo_surface_flush(atlas);
+        memset(cairo_image_surface_get_data(atlas), 0, (size_t)cairo_image_surface_get_stride(atlas) * rows * THUMB_HEIGHT);
+        for (int i = 0; i < *count; ++i) {
+            if (thumbnail_request_stale(serial)) {
+                cairo_surface_destroy(atlas);
+                atlas = NULL;
+                break;
+            }
+            char target[G_ASCII_DTOSTR_BUF_SIZE];
+            g_ascii_dtostr(target, sizeof(target), i * *interval);
+            const char *seek[] = {"seek", target, "absolute+keyframes", NULL};
+            if (mpv_command(mpv, seek) < 0 ||
+                wait_for_mpv_event(mpv, seek_events, PROBE_TIMEOUT, &thumbs.quit) != MPV_EVENT_PLAYBACK_RESTART) {
+                continue; // Leave the cell empty
+            }
+            grab_thumbnail(mpv, atlas, i, &scratch);
+        }
+        scale_scratch_free(&scratch);
+        if (atlas) {
+            cairo_surface_mark_dirty(atlas);
+        }
+    }
+    if (got != MPV_EVENT_END_FILE && !g_atomic_int_get(&thumbs.quit)) {
+        mpv_command(mpv, (const char *[]){"stop", NULL});
+        while (wait_for_mpv_event(mpv, file_events, 1.0, &thumbs.quit) == MPV_EVENT_FILE_LOADED) {
+        }
+    }
+    return atlas;
+}
+
+// Cache entry: <key>.png holds the atlas, <key>.atlas "interval count"
+static char *thumbnail_cache_key(const char *path) {
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) {
+        return NULL;
+    }
+    char *id = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT, path,
+                               (gint64)st.st_size, (gint64)st.st_mtime);
+    char *key = g_compute_checksum_for_string(G_CHECKSUM_SHA1, id, -1);
+    g_free(id);
+    return key;
+}
+
+static cairo_surface_t *load_cached_thumbnails(const char *key, double *interval, int *count) {
+    char *meta_file = g_strdup_printf("%s/%s.atlas", thumbs.cache_dir, key);
+    char *png_file = g_strdup_printf("%s/%s.png", thumbs.cache_dir, key);
+    char *meta = NULL;
+    cairo_surface_t *atlas = NULL;
+    if (g_file_get_contents(meta_file, &meta, NULL, NULL)) {
+        char *end = NULL;
+        *interval = g_ascii_strtod(meta, &end);
+        *count = end ? atoi(end) : 0;
+        if (*interval > 0 && *count > 0) {
+            atlas = cairo_image_surface_create_from_png(png_file);
+            if (cairo_surface_status(atlas) != CAIRO_STATUS_SUCCESS) {
+                cairo_surface_destroy(atlas);
+                atlas = NULL;
+            }
+        }
+    }
+    g_free(meta);
+    g_free(meta_file);
+    g_free(png_file);
+    return atlas;
+}
+
+static void store_cached_thumbnails(const char *key, cairo_surface_t *atlas, double interval, int count) {
+    g_mkdir_with_parents(thumbs.cache_dir, 0700);
+    char *png_file = g_strdup_printf("%s/%s.png", thumbs.cache_dir, key);
+    char *tmp_file = g_strdup_printf("%s.tmp", png_file);
+    // PNG first, through a rename, so a .atlas never points at a partial image
+    if (cairo_surface_write_to_png(atlas, tmp_file) == CAIRO_STATUS_SUCCESS && g_rename(tmp_file, png_file) == 0) {
+        char *meta_file = g_strdup_printf("%s/%s.atlas", thumbs.cache_dir, key);
+        char interval_text[G_ASCII_DTOSTR_BUF_SIZE];
+        char *meta = g_strdup_printf("%s %d\n", g_ascii_dtostr(interval_text, sizeof(interval_text), interval), count);
+        g_file_set_contents(meta_file, meta, -1, NULL);
+        g_free(meta);
+        g_free(meta_file);
+    } else {
+        g_unlink(tmp_file);
+    }
+    g_free(tmp_file);
+    g_free(png_file);
+}
+
+static gpointer thumbnail_thread(gpointer data) {
+    guint done_serial = 0;
+    g_mutex_lock(&thumbs.lock);
+    while (!g_atomic_int_get(&thumbs.quit)) {
+        if (thumbs.wanted_serial == done_serial) {
+            g_cond_wait(&thumbs.wake, &thumbs.lock);
+            continue;
+        }
+        done_serial = thumbs.wanted_serial;
+        char *path = g_strdup(thumbs.wanted);
+        g_mutex_unlock(&thumbs.lock);
+
+        char *key = path ? thumbnail_cache_key(path) : NULL;
+        double interval = 0;
+        int count = 0;
+        cairo_surface_t *atlas = key ? load_cached_thumbnails(key, &interval, &count) : NULL;
+        if (key && !atlas) {
+            if (!thumbs.mpv) {
+                mpv_handle *mpv = create_probe_handle();
+                if (mpv) {
+                    mpv_set_property_string(mpv, "hr-seek", "no");
+                }
+                g_mutex_lock(&thumbs.lock);
+                thumbs.mpv = mpv;
+                g_mutex_unlock(&thumbs.lock);
+            }
+            if (thumbs.mpv) {
+                gint64 start = g_get_monotonic_time();
+                atlas = generate_thumbnails(thumbs.mpv, path, done_serial, &interval, &count);
+                if (atlas) {
+                    printf("Thumbnails: %d for %s in %.2fs\n", count, path,
+                           (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC);
+                    store_cached_thumbnails(key, atlas, interval, count);
+                }
+            }
         }
+        g_free(key);
+        g_free(path);
+
+        g_mutex_lock(&thumbs.lock);
+        if (atlas && done_serial == thumbs.wanted_serial) {
+            thumbs.atlas = atlas;
+            thumbs.interval = interval;
+            thumbs.count = count;
+        } else if (atlas) {
+            cairo_surface_destroy(atlas);
+        }
+    }
+    g_mutex_unlock(&thumbs.lock);
+    return NULL;
+}
 
-        GSList *filenames, *iter;
-        GtkFileChooser *chooser = GTK_FILE_CHOOSER(dialog);
-        filenames = gtk_file_chooser_get_filenames(chooser);
-        iter = filenames;
+static void thumbnailer_init(void) {
+    g_mutex_init(&thumbs.lock);
+    g_cond_init(&thumbs.wake);
+    thumbs.cache_dir = g_build_filename(g_get_user_cache_dir(), "eluxi-player", "thumbnails", NULL);
+    thumbs.thread = g_thread_new("thumbnail_thread", thumbnail_thread, NULL);
+}
+
+// Called on the GTK thread whenever the playing file changes
+static void thumbnails_request(const char *path) {
+    g_mutex_lock(&thumbs.lock);
+    if (g_strcmp0(path, thumbs.wanted) != 0) {
+        g_free(thumbs.wanted);
+        thumbs.wanted = g_strdup(path);
+        thumbs.wanted_serial++;
+        if (thumbs.atlas) {
+            cairo_surface_destroy(thumbs.atlas);
+            thumbs.atlas = NULL;
+        }
+        g_cond_signal(&thumbs.wake);
+        if (thumbs.mpv) {
+            mpv_wakeup(thumbs.mpv); // Cut a wait on the previous file short
+        }
+    }
+    g_mutex_unlock(&thumbs.lock);
+}
 
-        // Create a "fake blank" video to force play_next_in_queue to run
-        video_queue = g_list_append(video_queue, g_strdup("Current Playlist"));
+static void thumbnailer_shutdown(void) {
+    g_mutex_lock(&thumbs.lock);
+    g_atomic_int_set(&thumbs.quit, 1);
+    g_cond_signal(&thumbs.wake);
+    if (thumbs.mpv) {
+        mpv_wakeup(thumbs.mpv);
+    }
+    g_mutex_unlock(&thumbs.lock);
+    g_thread_join(thumbs.thread);
+    if (thumbs.mpv) {
+        mpv_terminate_destroy(thumbs.mpv);
+    }
+    if (thumbs.atlas) {
+        cairo_surface_destroy(thumbs.atlas);
+    }
+    g_free(thumbs.wanted);
+    g_free(thumbs.cache_dir);
+    g_cond_clear(&thumbs.wake);
+    g_mutex_clear(&thumbs.lock);
+}
 
-        // Add the selected files to the video queue
-        for (; iter != NULL; iter = iter->next) {
-            char *filename = (char *)iter->data;
+// Draws the atlas cell chosen by seek_preview_update
+static gboolean on_preview_draw(GtkWidget *widget, cairo_t *cr, AppData *app) {
+    cairo_set_source_rgb(cr, 0, 0, 0);
+    cairo_paint(cr);
+    g_mutex_lock(&thumbs.lock);
+    if (thumbs.atlas && app->preview_index >= 0 && app->preview_index < thumbs.count) {
+        int cell_x = (app->preview_index % THUMB_COLUMNS) * THUMB_WIDTH;
+        int cell_y = (app->preview_index / THUMB_COLUMNS) * THUMB_HEIGHT;
+        cairo_set_source_surface(cr, thumbs.atlas, -cell_x, -cell_y);
+        cairo_rectangle(cr, 0, 0, THUMB_WIDTH, THUMB_HEIGHT);
+        cairo_fill(cr);
+    }
+    g_mutex_unlock(&thumbs.lock);
+    return TRUE;
+}
 
-            // Add each selected file to the video_queue
-            video_queue = g_list_append(video_queue, g_strdup(filename));
-            
-            g_free(filename);
-             
+// Keep the preview above the pointer at x. The popup is shown once when the
+// pointer arrives; after that it is only moved when x changes and redrawn
+// when the thumbnail or the time changes. Everything shown is already
+// decoded, so this is only a blit.
+static void seek_preview_update(AppData *app, GtkWidget *widget, double x) {
+    g_mutex_lock(&thumbs.lock);
+    gboolean have_atlas = thumbs.atlas != NULL;
+    double interval = thumbs.interval;
+    int count = thumbs.count;
+    g_mutex_unlock(&thumbs.lock);
+    if (!have_atlas) {
+        if (app->preview_x >= 0) {
+            gtk_widget_hide(app->preview_window);
+            app->preview_x = -1;
         }
+        return;
+    }
 
-        g_slist_free(filenames);
+    GdkRectangle trough;
+    gtk_range_get_range_rect(GTK_RANGE(widget), &trough);
+    GtkAdjustment *adjustment = gtk_range_get_adjustment(GTK_RANGE(widget));
+    double fraction = trough.width > 0 ? (x - trough.x) / trough.width : 0;
+    double seconds = CLAMP(fraction, 0.0, 1.0) * gtk_adjustment_get_upper(adjustment);
+    int index = CLAMP((int)(seconds / interval), 0, count - 1);
+    if (index != app->preview_index) {
+        app->preview_index = index;
+        gtk_widget_queue_draw(app->preview_area);
+    }
+    int total = (int)seconds;
+    if (total != app->preview_seconds) {
+        app->preview_seconds = total;
+        char text[32];
+        snprintf(text, sizeof(text), "%d:%02d:%02d", total / 3600, (total % 3600) / 60, total % 60);
+        gtk_label_set_text(GTK_LABEL(app->preview_label), total >= 3600 ? text : text + 2);
+    }
 
-        // Update the playlist UI to reflect the new video queue
-        update_playlist(app->playlist_box, video_queue, app);
-        update_playlist_menu(app, video_queue); // Update the menu
+    gboolean shown = app->preview_x >= 0;
+    if (shown && (int)x == app->preview_x) {
+        return;
+    }
+    app->preview_x = MAX((int)x, 0);
+    if (!shown) {
+        gtk_widget_show_all(app->preview_window);
+    }
+    GtkAllocation allocation;
+    gtk_widget_get_allocation(widget, &allocation);
+    gint origin_x, origin_y;
+    gdk_window_get_origin(gtk_widget_get_window(widget), &origin_x, &origin_y);
+    gint width, height;
+    gtk_window_get_size(GTK_WINDOW(app->preview_window), &width, &height);
+    gtk_window_move(GTK_WINDOW(app->preview_window),
+                    origin_x + allocation.x + (gint)x - width / 2,
+                    origin_y + allocation.y - height - 8);
+}
 
-        
+static gboolean on_slider_enter(GtkWidget *widget, GdkEventCrossing *event, AppData *app) {
+    seek_preview_update(app, widget, event->x);
+    return FALSE;
+}
 
-        // Add the play_next_in_queue function to the idle loop
-        //g_idle_add((GSourceFunc)play_next_in_queue, app);
-        current_video = video_queue->next;
-        g_timeout_add(2000, (GSourceFunc)play_next_in_queue_false, app);
-        gtk_widget_destroy(dialog);
-    }
+static gboolean on_slider_motion(GtkWidget *widget, GdkEventMotion *event, AppData *app) {
+    seek_preview_update(app, widget, event->x);
+    return FALSE;
 }
 
+static gboolean on_slider_leave(GtkWidget *widget, GdkEventCrossing *event, AppData *app) {
+    gtk_widget_hide(app->preview_window);
+    app->preview_x = -1;
+    return FALSE;
+}
 
+static void create_seek_preview(AppData *app) {
+    GtkWidget *window = gtk_window_new(GTK_WINDOW_POPUP);
+    gtk_window_set_transient_for(GTK_WINDOW(window), GTK_WINDOW(app->window));
+    gtk_window_set_type_hint(GTK_WINDOW(window), GDK_WINDOW_TYPE_HINT_TOOLTIP);
+    GtkWidget *box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 2);
+    GtkWidget *area = gtk_drawing_area_new();
+    gtk_widget_set_size_request(area, THUMB_WIDTH, THUMB_HEIGHT);
+    g_signal_connect(area, "draw", G_CALLBACK(on_preview_draw), app);
+    GtkWidget *label = gtk_label_new(NULL);
+    gtk_box_pack_start(GTK_BOX(box), area, FALSE, FALSE, 0);
+    gtk_box_pack_start(GTK_BOX(box), label, FALSE, FALSE, 0);
+    gtk_container_add(GTK_CONTAINER(window), box);
+
+    app->preview_window = window;
+    app->preview_area = area;
+    app->preview_label = label;
+    app->preview_index = -1;
+    app->preview_x = -1;
+    app->preview_seconds = -1;
+
+    gtk_widget_add_events(app->slider, GDK_POINTER_MOTION_MASK | GDK_ENTER_NOTIFY_MASK | GDK_LEAVE_NOTIFY_MASK);
+    g_signal_connect(app->slider, "enter-notify-event", G_CALLBACK(on_slider_enter), app);
+    g_signal_connect(app->slider, "motion-notify-event", G_CALLBACK(on_slider_motion), app);
+    g_signal_connect(app->slider, "leave-notify-event", G_CALLBACK(on_slider_leave), app);
+}
 
-// Function to draw the video (GTK draw callback)
 static gboolean on_draw(GtkWidget *widget, cairo_t *cr, AppData *app) {
     GdkRectangle rect;
     rect.x = 0;
@@ -644,12 +5052,12 @@ static void on_drawing_area_realized(GtkWidget *widget, AppData *app) {
         fprintf(stderr, "Error: Could not get GdkWindow from drawing area.\n");
         return;
     }
-    unsigned long window_id = GDK_WINDOW_XID(gdk_window);
-    mpv_set_option(app->mpv, "wid", MPV_FORMAT_INT64, &window_id);
-    mpv_set_option_string(app->mpv, "vo", "x11");
-    mpv_set_option_string(app->mpv, "osc", "no");
-    mpv_set_option_string(app->mpv, "hwdec", "auto");
-    mpv_command(app->mpv, (const char *[]){"initialize", NULL});
+    if (!app->sw_render) { // The software path draws in on_draw_frame instead
+        unsigned long window_id = GDK_WINDOW_XID(gdk_window);
+        mpv_set_option(app->mpv, "wid", MPV_FORMAT_INT64, &window_id);
+        mpv_set_option_string(app->mpv, "vo", "x11");
+    }
+    startup_mark("video area realized");
 
     // Set target_widget here, after the window is realized
     target_widget = widget;
@@ -668,36 +5076,27 @@ static void on_drawing_area_realized(GtkWidget *widget, AppData *app) {
     }
 }
 
-static gboolean update_slider(gpointer user_data) {
-    AppData *app = (AppData *)user_data;
-    if (!app || !app->mpv) return TRUE;
-
-    double position = 0;
-    double duration = 0;
-
-    // Get current playback position
-    if (mpv_get_property(app->mpv, "time-pos", MPV_FORMAT_DOUBLE, &position) < 0)
-        position = 0;
-
-    // Get total duration
-    if (mpv_get_property(app->mpv, "duration", MPV_FORMAT_DOUBLE, &duration) < 0)
-        duration = 0;
-
-    if (!app->slider_dragging) {
-        gtk_range_set_range(GTK_RANGE(app->slider), 0, (gint)duration);
-        gtk_range_set_value(GTK_RANGE(app->slider), (gint)position);
+// Update duration label with current time / total duration format
+// The label only shows whole seconds, so skip formatting (and relayout)
+// for the many position updates that don't change the visible text.
+static void update_duration_label(AppData *app, double position, double duration) {
+    gint64 pos_sec = position > 0 ? (gint64)position : 0;
+    gint64 dur_sec = duration > 0 ? (gint64)duration : 0;
+    if (pos_sec == app->shown_position_sec && dur_sec == app->shown_duration_sec) {
+        return;
     }
-
-    // Update duration label with current time / total duration format
-    int current_hours = (int)position / 3600;
-    int current_minutes = ((int)position % 3600) / 60;
-    int current_seconds = (int)position % 60;
-    int total_hours = (int)duration / 3600;
-    int total_minutes = ((int)duration % 3600) / 60;
-    int total_seconds = (int)duration % 60;
+    app->shown_position_sec = pos_sec;
+    app->shown_duration_sec = dur_sec;
+
+    int current_hours = (int)(pos_sec / 3600);
+    int current_minutes = (int)(pos_sec % 3600) / 60;
+    int current_seconds = (int)(pos_sec % 60);
+    int total_hours = (int)(dur_sec / 3600);
+    int total_minutes = (int)(dur_sec % 3600) / 60;
+    int total_seconds = (int)(dur_sec % 60);
     char label_text[64]; // Increased size to accommodate the longer string
 
-    if (duration > 3600) { //Use HH:MM:SS if duration is over 1 hour
+    if (dur_sec > 3600) { //Use HH:MM:SS if duration is over 1 hour
         snprintf(label_text, sizeof(label_text), "%d:%02d:%02d/%d:%02d:%02d",
                  current_hours, current_minutes, current_seconds,
                  total_hours, total_minutes, total_seconds);
@@ -707,8 +5106,121 @@ static gboolean update_slider(gpointer user_data) {
                  total_minutes, total_seconds);
     }
     gtk_label_set_text(GTK_LABEL(app->duration_label), label_text);
+}
 
-    return TRUE;
+// Seek pipeline: at most one seek is in flight. While it is, newer targets
+// just overwrite seek_target, so dragging never builds up a backlog in mpv.
+static void send_queued_seek(AppData *app);
+
+static void seek_settled(AppData *app) {
+    app->seek_in_flight = FALSE;
+    if (app->seek_queued) {
+        send_queued_seek(app);
+    }
+}
+
+static void on_seek_reply(AppData *app, const MpvReply *reply, gpointer user_data) {
+    if (reply->error < 0) { // No PLAYBACK_RESTART will follow
+        fprintf(stderr, "MPV: seek failed: %s\n", mpv_error_string(reply->error));
+        seek_settled(app);
+    }
+}
+
+static void send_queued_seek(AppData *app) {
+    char target[G_ASCII_DTOSTR_BUF_SIZE];
+    g_ascii_dtostr(target, sizeof(target), app->seek_target);
+    const char *cmd[] = {"seek", target, app->seek_exact ? "absolute+exact" : "absolute+keyframes", NULL};
+    app->seek_queued = FALSE;
+    app->seek_in_flight = TRUE;
+    async_command(app, cmd, on_seek_reply, NULL);
+}
+
+static void request_seek(AppData *app, double target, gboolean exact) {
+    app->seek_target = target;
+    app->seek_exact = exact;
+    app->seek_queued = TRUE;
+    if (!app->seek_in_flight) {
+        send_queued_seek(app);
+    }
+}
+
+static void update_play_button(AppData *app, gboolean show_play) {
+    const char *icon = show_play ? "media-playback-start" : "media-playback-pause";
+    gtk_button_set_image(GTK_BUTTON(app->play_button), gtk_image_new_from_icon_name(icon, GTK_ICON_SIZE_BUTTON));
+}
+
+// Idle: settle seeks and follow mpv's playlist position, whether or not the
+// window is being drawn
+static gboolean apply_state_changes(gpointer data) {
+    AppData *app = (AppData *)data;
+    guint dirty = g_atomic_int_and(&app->state_dirty, 0);
+    if (dirty & UI_DIRTY_SEEK) {
+        seek_settled(app);
+    }
+    if (dirty & UI_DIRTY_PLAYLIST) {
+        PlayerSnapshot snap;
+        player_state_read(&app->state, &snap);
+        follow_mpv_playlist_pos(app, snap.playlist_pos);
+    }
+    if (dirty & UI_DIRTY_PLAYING) {
+        session_autosave_update(app);
+    }
+    return G_SOURCE_REMOVE;
+}
+
+// Frame-clock callback: push everything that changed since the last frame
+// into the widgets, then uninstall itself once nothing is left to do.
+static gboolean flush_ui_changes(GtkWidget *widget, GdkFrameClock *clock, gpointer user_data) {
+    AppData *app = (AppData *)user_data;
+    guint dirty = g_atomic_int_and(&app->ui_dirty, 0);
+    if (dirty == 0) {
+        app->ui_tick_id = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    PlayerSnapshot snap;
+    player_state_read(&app->state, &snap);
+    double position = snap.time_pos;
+    double duration = snap.duration;
+
+    if (dirty & UI_DIRTY_DURATION) {
+        gtk_range_set_range(GTK_RANGE(app->slider), 0, duration > 0 ? duration : 0);
+    }
+    if (dirty & (UI_DIRTY_POSITION | UI_DIRTY_DURATION)) {
+        // Don't yank the knob back while a seek is still on its way
+        if (!app->slider_dragging && !app->seek_in_flight && !app->seek_queued) {
+            gtk_range_set_value(GTK_RANGE(app->slider), position);
+        }
+        update_duration_label(app, position, duration);
+    }
+    if (dirty & UI_DIRTY_PAUSE) {
+        update_play_button(app, snap.pause || snap.eof_reached);
+    }
+    if (dirty & UI_DIRTY_VOLUME) {
+        // Don't echo the value straight back to mpv
+        g_signal_handlers_block_by_func(app->volume_slider, on_volume_changed, app);
+        gtk_range_set_value(GTK_RANGE(app->volume_slider), snap.volume);
+        g_signal_handlers_unblock_by_func(app->volume_slider, on_volume_changed, app);
+    }
+    if (dirty & UI_DIRTY_TRACKS) {
+        gtk_widget_set_sensitive(app->video_track_button, snap.video_tracks > 0);
+        gtk_widget_set_sensitive(app->audio_track_button, snap.audio_tracks > 0);
+        gtk_widget_set_sensitive(app->subtitle_button, snap.sub_tracks > 0);
+    }
+    if (dirty & UI_DIRTY_PATH) {
+        thumbnails_request(snap.path[0] ? snap.path : NULL);
+        app->preview_index = -1; // Cell of the previous file's atlas
+        if (snap.path[0]) {
+            char *base = g_path_get_basename(snap.path);
+            char *title = g_strdup_printf("%s - Eluxi-Player", base);
+            gtk_window_set_title(GTK_WINDOW(app->window), title);
+            g_free(title);
+            g_free(base);
+        } else {
+            gtk_window_set_title(GTK_WINDOW(app->window), "Eluxi-Player");
+        }
+    }
+    return G_SOURCE_CONTINUE;
 }
 
 static gboolean on_slider_pressed(GtkWidget *widget, GdkEventButton *event, AppData *app) {
@@ -718,104 +5230,42 @@ static gboolean on_slider_pressed(GtkWidget *widget, GdkEventButton *event, AppD
 
 static gboolean on_slider_released(GtkWidget *widget, GdkEventButton *event, AppData *app) {
     app->slider_dragging = FALSE;
-    double new_pos = gtk_range_get_value(GTK_RANGE(app->slider));
-    mpv_set_property(app->mpv, "time-pos", MPV_FORMAT_DOUBLE, &new_pos);
+    // Land exactly where the knob was let go, replacing any queued preview seek
+    request_seek(app, gtk_range_get_value(GTK_RANGE(app->slider)), TRUE);
     return FALSE;
 }
 
 static void on_slider_moved(GtkRange *range, AppData *app) {
     if (app->slider_dragging) {
-        // Optional: preview while dragging
+        // Live preview: keyframe seeks are cheap even on 4K HEVC
+        request_seek(app, gtk_range_get_value(range), FALSE);
     }
 }
 
 // Function to handle volume changes
 static void on_volume_changed(GtkRange *range, AppData *app) {
     double volume = gtk_range_get_value(range);
-    mpv_set_property(app->mpv, "volume", MPV_FORMAT_DOUBLE, &volume);
-}
-
-static void update_volume_slider(AppData *app) {
-    double volume = 0;
-    if (mpv_get_property(app->mpv, "volume", MPV_FORMAT_DOUBLE, &volume) == 0) {
-        gtk_range_set_value(GTK_RANGE(app->volume_slider), volume);
-    }
+    async_set_property(app, "volume", MPV_FORMAT_DOUBLE, &volume, NULL, NULL);
 }
 
 static void on_play_button_clicked(GtkWidget *button, AppData *app) {
-     int pause = 0;
-     if (!app->mpv) {
+    if (!app->mpv) {
         fprintf(stderr, "MPV is not initialized.\n");
         return;
     }
-    if (mpv_get_property(app->mpv, "pause", MPV_FORMAT_FLAG, &pause) >= 0) {
-        pause = !pause;
-        mpv_set_property(app->mpv, "pause", MPV_FORMAT_FLAG, &pause);
-    } else {
-        fprintf(stderr, "Failed to get pause property.\n");
-    }
+    // Let mpv flip it; no need to read the current state first
+    async_command(app, (const char *[]){"cycle", "pause", NULL}, NULL, NULL);
 
-    // Update button label
-    if (pause) {
-        // GtkWidget *old_image = gtk_button_get_image(GTK_BUTTON(app->play_button));
-        // if (old_image) {
-        //     gtk_widget_destroy(old_image);  // Free the old image
-        // }
-        GtkWidget *play_icon = gtk_image_new_from_icon_name("media-playback-start", GTK_ICON_SIZE_BUTTON);
-        gtk_button_set_image(GTK_BUTTON(app->play_button), play_icon);
-    } else {
-        // GtkWidget *old_image = gtk_button_get_image(GTK_BUTTON(app->play_button));
-        // if (old_image) {
-        //     gtk_widget_destroy(old_image);  // Free the old image
-        // }
-        GtkWidget *pause_icon = gtk_image_new_from_icon_name("media-playback-pause", GTK_ICON_SIZE_BUTTON);
-        gtk_button_set_image(GTK_BUTTON(app->play_button), pause_icon);
-    }
+    // The button icon follows the observed "pause" property
 }
 
-
-
 // Function to add files to the video queue
-void add_to_video_queue(const char *filename) {
-    video_queue = g_list_append(video_queue, g_strdup(filename));
-}
-
-
-void load_next_video(mpv_handle *mpv, AppData *app) {
-    if (video_queue && video_queue->next) {
-        // Reset color of the previously playing item
-        if (app->current_playlist_item) {
-            GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-            gtk_style_context_remove_class(context, "playing-video");
-        }
-
-        current_video = current_video ? current_video->next : video_queue;
-
-        // Find the corresponding menu item and set its color
-        GList *children = gtk_container_get_children(GTK_CONTAINER(app->playlist_box));
-        for (GList *child = children; child != NULL; child = child->next) {
-            if (GTK_IS_MENU_ITEM(child->data)) {
-                const char *item_label = gtk_menu_item_get_label(GTK_MENU_ITEM(child->data));
-                if (item_label && strcmp(item_label, (char *)current_video->data) == 0) {
-                    app->current_playlist_item = GTK_WIDGET(child->data);
-                    GtkStyleContext *context = gtk_widget_get_style_context(app->current_playlist_item);
-                    gtk_style_context_add_class(context, "playing-video");
-                    break;
-                }
-            }
-        }
-
-        load_file_in_mpv(app->mpv, (char *)current_video->data);
-    }
-}
-
-// Event handler to handle when the current video finishes
-static void on_video_end(mpv_handle *mpv, AppData *app) {
-    load_next_video(mpv, app);
+void add_to_video_queue(AppData *app, const char *filename) {
+    guint id = playlist_append(filename, NULL, -1);
+    playlist_view_append(app, playlist_get(playlist_index_of(id)));
+    mpv_playlist_send_appends(app);
 }
 
-
-
 // When hovering over the rightmost 20%, show the playlist
 static gboolean on_hover_enter(GtkWidget *widget, GdkEvent *event, GtkWidget *playlist_box) {
     //gtk_widget_set_visible(playlist_box, TRUE);
@@ -934,471 +5384,269 @@ gboolean on_key_press_space(GtkWidget *window, GdkEventKey *event, gpointer user
 gboolean on_key_press(GtkWidget *widget, GdkEventKey *event, gpointer user_data) {
     // Check if F2 is pressed
     if (event->keyval == GDK_KEY_F3) {
-        // Toggle the visibility of the playlist box
-        toggle_playlist_visibility((GtkWidget *)user_data);
+        // Toggle the visibility of the playlist
+        toggle_playlist_visibility((AppData *)user_data);
         return TRUE;  // Event handled
     }
+    // Step one frame forward/back (mpv pauses playback for this)
+    if (event->keyval == GDK_KEY_period) {
+        async_command((AppData *)user_data, (const char *[]){"frame-step", NULL}, NULL, NULL);
+        return TRUE;
+    }
+    if (event->keyval == GDK_KEY_comma) {
+        async_command((AppData *)user_data, (const char *[]){"frame-back-step", NULL}, NULL, NULL);
+        return TRUE;
+    }
     return FALSE;  // Event not handled
 }
 
-// Function to get available subtitle tracks from MPV
-static SubtitleTracks get_available_sub_tracks(mpv_handle *mpv) {
-    SubtitleTracks sub_tracks = {NULL, 0};
-    mpv_node node;
-
-    if (mpv_get_property(mpv, "track-list", MPV_FORMAT_NODE, &node) == 0 && node.format == MPV_FORMAT_NODE_ARRAY) {
-        mpv_node_list *track_list = node.u.list;
-
-        // First, count subtitle tracks
-        int subtitle_count = 0;
-        for (int i = 0; i < track_list->num; ++i) {
-            if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                mpv_node_list *track = track_list->values[i].u.list;
-                mpv_node *type_node = mpv_node_list_find_property(track, "type");
-                if (type_node && type_node->format == MPV_FORMAT_STRING &&
-                    strcmp(type_node->u.string, "sub") == 0) {
-                    subtitle_count++;
-                }
-            }
-        }
-
-        if (subtitle_count > 0) {
-            sub_tracks.tracks = g_malloc((subtitle_count + 1) * sizeof(char*));
-            if (!sub_tracks.tracks) {
-                fprintf(stderr, "Memory allocation failed in get_available_sub_tracks\n");
-                mpv_free_node_contents(&node);
-                return sub_tracks; // Return empty structure
-            }
-
-            int current_index = 0;
-            for (int i = 0; i < track_list->num; ++i) {
-                if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                    mpv_node_list *track = track_list->values[i].u.list;
-                    mpv_node *type_node = mpv_node_list_find_property(track, "type");
-                    if (type_node && type_node->format == MPV_FORMAT_STRING &&
-                        strcmp(type_node->u.string, "sub") == 0) {
-                        mpv_node *lang_node = mpv_node_list_find_property(track, "lang");
-                        mpv_node *id_node = mpv_node_list_find_property(track, "id");
-
-                        if (id_node && id_node->format == MPV_FORMAT_INT64) {
-                            if (lang_node && lang_node->format == MPV_FORMAT_STRING) {
-                                sub_tracks.tracks[current_index++] = g_strdup_printf("%s (ID: %lld)",
-                                                                                    lang_node->u.string,
-                                                                                    (long long)id_node->u.int64);
-                            } else {
-                                sub_tracks.tracks[current_index++] = g_strdup_printf("Track %lld",
-                                                                                    (long long)id_node->u.int64);
-                            }
-                        }
-                    }
-                }
-            }
-            sub_tracks.tracks[current_index] = NULL;
-            sub_tracks.count = current_index;
-        }
-        mpv_free_node_contents(&node);
+// Menu label for a track, e.g. "Commentary (eng, aac, default)"
+static char *track_label(const TrackInfo *track) {
+    GString *label = g_string_new(NULL);
+    if (track->title) {
+        g_string_append(label, track->title);
+    } else if (track->lang) {
+        g_string_append(label, track->lang);
     } else {
-        fprintf(stderr, "Failed to get track-list from MPV\n");
+        g_string_append_printf(label, "Track %lld", (long long)track->id);
     }
-
-    return sub_tracks;
-}
-
-// Function to free subtitle track data
-static void free_subtitle_tracks(SubtitleTracks *sub_tracks) {
-    if (sub_tracks->tracks) {
-        for (int i = 0; i < sub_tracks->count; ++i) {
-            g_free(sub_tracks->tracks[i]);
+    const char *details[] = {track->title ? track->lang : NULL, track->codec,
+                             track->is_default ? "default" : NULL, track->forced ? "forced" : NULL};
+    const char *separator = " (";
+    for (guint i = 0; i < G_N_ELEMENTS(details); ++i) {
+        if (details[i]) {
+            g_string_append_printf(label, "%s%s", separator, details[i]);
+            separator = ", ";
         }
-        g_free(sub_tracks->tracks);
-        sub_tracks->tracks = NULL;
-        sub_tracks->count = 0;
     }
-}
-
-// Function to free subtitle track data
-static void free_video_tracks(VideoTracks *sub_tracks) {
-    if (sub_tracks->tracks) {
-        for (int i = 0; i < sub_tracks->count; ++i) {
-            //g_free(sub_tracks->tracks[i]);
-            sub_tracks->tracks[i] = NULL;
-        }
-        //g_free(sub_tracks->tracks);
-        sub_tracks->tracks = NULL;
-        sub_tracks->count = 0;
+    if (separator[0] == ',') {
+        g_string_append_c(label, ')');
     }
+    return g_string_free(label, FALSE);
 }
 
-// Function to free subtitle track data
-static void free_audio_tracks(AudioTracks *sub_tracks) {
-    if (sub_tracks->tracks) {
-        for (int i = 0; i < sub_tracks->count; ++i) {
-            //g_free(sub_tracks->tracks[i]);
-            sub_tracks->tracks[i] = NULL;
-        }
-        //g_free(sub_tracks->tracks);
-        sub_tracks->tracks = NULL;
-        sub_tracks->count = 0;
+// A track menu item was picked; its type and ID were stored on it when the
+// menu was built (ID 0 is "None", mpv numbers tracks from 1)
+static void on_track_selected(GtkWidget *menu_item, AppData *app_data) {
+    if (!gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(menu_item))) {
+        return; // The item that lost the mark
     }
-}
-
-static void on_vmenu_destroyed(gpointer data, GObject *where_the_object_was) {
-    VideoTrackCleanupData *cleanup = (VideoTrackCleanupData *)data;
-    free_video_tracks(&cleanup->tracks);
-    //g_free(cleanup);
-}
-
-static void on_amenu_destroyed(gpointer data, GObject *where_the_object_was) {
-    AudioTrackCleanupData *cleanup = (AudioTrackCleanupData *)data;
-    free_audio_tracks(&cleanup->tracks);
-    //g_free(cleanup);
-}
-
-
-
-// Function to handle subtitle selection
-static void on_subtitle_selected(GtkWidget *menu_item, AppData *app_data) {
-    const gchar *label = gtk_menu_item_get_label(GTK_MENU_ITEM(menu_item));
-    if (strcmp(label, "None") == 0) {
-        mpv_set_property_string(app_data->mpv, "sid", "no");
+    TrackType type = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(menu_item), "track-type"));
+    gint64 id = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(menu_item), "track-id"));
+    if (id == 0) {
+        async_set_property_string(app_data, track_type_properties[type], "no");
     } else {
-        // Improved ID extraction: Look for "ID: " followed by digits
-        const char *id_start = strstr(label, "ID: ");
-        if (id_start) {
-            long long subtitle_id = strtoll(id_start + 4, NULL, 10); // Move past "ID: "
-            if (errno == ERANGE) {
-                fprintf(stderr, "Subtitle ID out of range: %s\n", label);
-                return; // Or handle the error as appropriate
-            }
-            mpv_set_property(app_data->mpv, "sid", MPV_FORMAT_INT64, &subtitle_id);
-        } else {
-            fprintf(stderr, "Could not extract subtitle ID from label: %s\n", label);
-        }
+        async_set_property(app_data, track_type_properties[type], MPV_FORMAT_INT64, &id, NULL, NULL);
     }
 }
 
-// Function to create the subtitle menu
-static GtkWidget *create_subtitle_menu(AppData *app_data) {
-    GtkWidget *menu = gtk_menu_new();
-    GtkWidget *none_item = gtk_menu_item_new_with_label("None");
-    g_signal_connect(none_item, "activate", G_CALLBACK(on_subtitle_selected), app_data);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), none_item);
-    gtk_widget_show(none_item);
+static void append_track_item(GtkWidget *menu, AppData *app_data, TrackType type, gint64 id, const char *label,
+                              GSList **group) {
+    GtkWidget *item = gtk_radio_menu_item_new_with_label(*group, label);
+    *group = gtk_radio_menu_item_get_group(GTK_RADIO_MENU_ITEM(item));
+    g_object_set_data(G_OBJECT(item), "track-type", GINT_TO_POINTER(type));
+    g_object_set_data(G_OBJECT(item), "track-id", GINT_TO_POINTER((gint)id));
+    g_signal_connect(item, "toggled", G_CALLBACK(on_track_selected), app_data);
+    gtk_menu_shell_append(GTK_MENU_SHELL(menu), item);
+    gtk_widget_show(item);
+}
 
-    SubtitleTracks sub_tracks = get_available_sub_tracks(app_data->mpv);
-    if (sub_tracks.tracks) {
-        for (int i = 0; i < sub_tracks.count; ++i) {
-            GtkWidget *track_item = gtk_menu_item_new_with_label(sub_tracks.tracks[i]);
-            g_signal_connect(track_item, "activate", G_CALLBACK(on_subtitle_selected), app_data);
-            gtk_menu_shell_append(GTK_MENU_SHELL(menu), track_item);
-            gtk_widget_show(track_item);
+// Build the menu for one track type; "None" starts out marked
+static GtkWidget *create_track_menu(AppData *app_data, TrackType type, GArray *tracks) {
+    GtkWidget *menu = gtk_menu_new();
+    GSList *group = NULL;
+    append_track_item(menu, app_data, type, 0, "None", &group);
+    for (guint i = 0; tracks && i < tracks->len; ++i) {
+        const TrackInfo *track = &g_array_index(tracks, TrackInfo, i);
+        if (track->type == type) {
+            char *label = track_label(track);
+            append_track_item(menu, app_data, type, track->id, label, &group);
+            g_free(label);
         }
     }
-    free_subtitle_tracks(&sub_tracks); // Free immediately after use!
-
     return menu;
 }
 
-// Function to handle subtitle button clicks
-static void on_subtitle_button_clicked(GtkWidget *button, AppData *app_data) {
-    GtkWidget *subtitle_menu = create_subtitle_menu(app_data);
-    gtk_menu_popup_at_widget(GTK_MENU(subtitle_menu), button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
-    // GTK will handle destroying the menu when it's closed
-}
-
-
-// Function to get available video tracks from MPV
-static VideoTracks get_available_video_tracks(mpv_handle *mpv) {
-    VideoTracks video_tracks = {NULL, 0}; // Reuse SubtitleTracks struct
-    mpv_node node;
-
-    if (mpv_get_property(mpv, "track-list", MPV_FORMAT_NODE, &node) == 0 && node.format == MPV_FORMAT_NODE_ARRAY) {
-        mpv_node_list *track_list = node.u.list;
-
-        // First, count video tracks
-        int video_count = 0;
-        for (int i = 0; i < track_list->num; ++i) {
-            if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                mpv_node_list *track = track_list->values[i].u.list;
-                mpv_node *type_node = mpv_node_list_find_property(track, "type");
-                if (type_node && type_node->format == MPV_FORMAT_STRING &&
-                    strcmp(type_node->u.string, "video") == 0) {
-                    video_count++;
-                }
-            }
-        }
-
-        if (video_count > 0) {
-            video_tracks.tracks = g_malloc0((video_count + 1) * sizeof(char*));
-            for (int i = 0; i < video_count + 1; ++i)
-            video_tracks.tracks[i] = NULL;
-            if (!video_tracks.tracks) {
-                fprintf(stderr, "Memory allocation failed in get_available_video_tracks\n");
-                mpv_free_node_contents(&node);
-                return video_tracks;
-            }
-
-            int current_index = 0;
-            for (int i = 0; i < track_list->num; ++i) {
-                if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                    mpv_node_list *track = track_list->values[i].u.list;
-                    mpv_node *id_node = mpv_node_list_find_property(track, "id");
-                    mpv_node *lang_node = mpv_node_list_find_property(track, "lang");
-                    if (id_node && id_node->format == MPV_FORMAT_INT64) {
-                        if (lang_node && lang_node->format == MPV_FORMAT_STRING) {
-                            video_tracks.tracks[current_index] = g_strdup_printf("%s (ID: %lld)",
-                                                                                 lang_node->u.string,
-                                                                                 (long long)id_node->u.int64);
-                        } else {
-                            video_tracks.tracks[current_index] = g_strdup_printf("Track %lld",
-                                                                                 (long long)id_node->u.int64);
-                        }
-                        current_index++;
-                    }
-                }
-            }
-            video_tracks.tracks[current_index] = NULL;
-            video_tracks.count = current_index;
+// Move the radio mark to the item for id without telling mpv about it
+static void track_menu_mark(TrackMenu *cached, AppData *app_data, gint64 id) {
+    GList *items = gtk_container_get_children(GTK_CONTAINER(cached->menu));
+    for (GList *l = items; l; l = l->next) {
+        if (GPOINTER_TO_INT(g_object_get_data(G_OBJECT(l->data), "track-id")) == id) {
+            g_signal_handlers_block_by_func(l->data, on_track_selected, app_data);
+            gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(l->data), TRUE);
+            g_signal_handlers_unblock_by_func(l->data, on_track_selected, app_data);
         }
-        mpv_free_node_contents(&node);
-    } else {
-        fprintf(stderr, "Failed to get track-list from MPV\n");
     }
-
-    return video_tracks;
+    g_list_free(items);
+    cached->selected = id;
 }
 
-// Function to get available audio tracks from MPV
-static AudioTracks get_available_audio_tracks(mpv_handle *mpv) {
-    AudioTracks audio_tracks = {NULL, 0}; // Reuse SubtitleTracks struct
-    mpv_node node;
-
-    if (mpv_get_property(mpv, "track-list", MPV_FORMAT_NODE, &node) == 0 && node.format == MPV_FORMAT_NODE_ARRAY) {
-        mpv_node_list *track_list = node.u.list;
-
-        // First, count audio tracks
-        int audio_count = 0;
-        for (int i = 0; i < track_list->num; ++i) {
-            if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                mpv_node_list *track = track_list->values[i].u.list;
-                mpv_node *type_node = mpv_node_list_find_property(track, "type");
-                if (type_node && type_node->format == MPV_FORMAT_STRING &&
-                    strcmp(type_node->u.string, "audio") == 0) {
-                    audio_count++;
-                }
-            }
-        }
-
-        if (audio_count > 0) {
-            audio_tracks.tracks = g_malloc0((audio_count + 1) * sizeof(char*));
-            for (int i = 0; i < audio_count + 1; ++i)
-            audio_tracks.tracks[i] = NULL;
-            if (!audio_tracks.tracks) {
-                fprintf(stderr, "Memory allocation failed in get_available_audio_tracks\n");
-                mpv_free_node_contents(&node);
-                return audio_tracks;
-            }
-
-            int current_index = 0;
-            for (int i = 0; i < track_list->num; ++i) {
-                if (track_list->values[i].format == MPV_FORMAT_NODE_MAP) {
-                    mpv_node_list *track = track_list->values[i].u.list;
-                    mpv_node *id_node = mpv_node_list_find_property(track, "id");
-                    mpv_node *lang_node = mpv_node_list_find_property(track, "lang");
-
-                    if (id_node && id_node->format == MPV_FORMAT_INT64) {
-                        if (lang_node && lang_node->format == MPV_FORMAT_STRING) {
-                            audio_tracks.tracks[current_index] = g_strdup_printf("%s (ID: %lld)",
-                                                                                 lang_node->u.string,
-                                                                                 (long long)id_node->u.int64);
-                        } else {
-                            audio_tracks.tracks[current_index] = g_strdup_printf("Track %lld",
-                                                                                 (long long)id_node->u.int64);
-                        }
-                        current_index++;
-                    }
-                }
-            }
-            audio_tracks.tracks[current_index] = NULL;
-            audio_tracks.count = current_index;
-        }
-        mpv_free_node_contents(&node);
-    } else {
-        fprintf(stderr, "Failed to get track-list from MPV\n");
+// Show the menu for one track type under its button. The cached menu is
+// used as long as the tracks of that type haven't changed; a different
+// selection only moves the mark.
+static void popup_track_menu(AppData *app_data, TrackType type, GtkWidget *button) {
+    TrackMenu *cached = &track_menus[type];
+    guint generation;
+    GArray *tracks = track_model_get(type, &generation);
+    if (cached->menu && cached->generation != generation) {
+        gtk_widget_destroy(cached->menu);
+        cached->menu = NULL;
     }
-
-    return audio_tracks;
-}
-
-// Function to handle video track selection
-static void on_video_track_selected(GtkWidget *menu_item, AppData *app_data) {
-    const gchar *label = gtk_menu_item_get_label(GTK_MENU_ITEM(menu_item));
-    if (strcmp(label, "None") == 0) {
-        mpv_set_property_string(app_data->mpv, "vid", "no");
-    } else {
-        // Improved ID extraction: Look for "ID: " followed by digits
-        const char *id_start = strstr(label, "ID: ");
-        if (id_start) {
-            long long video_id = strtoll(id_start + 4, NULL, 10); // Move past "ID: "
-            if (errno == ERANGE) {
-                fprintf(stderr, "Video ID out of range: %s\n", label);
-                return; // Or handle the error as appropriate
-            }
-            mpv_set_property(app_data->mpv, "vid", MPV_FORMAT_INT64, &video_id);
-        } else {
-            fprintf(stderr, "Could not extract video ID from label: %s\n", label);
-        }
+    if (!cached->menu) {
+        cached->menu = create_track_menu(app_data, type, tracks);
+        cached->generation = generation;
+        cached->selected = 0;
     }
-}
-
-// Function to handle audio track selection
-static void on_audio_track_selected(GtkWidget *menu_item, AppData *app_data) {
-    const gchar *label = gtk_menu_item_get_label(GTK_MENU_ITEM(menu_item));
-    if (strcmp(label, "None") == 0) {
-        mpv_set_property_string(app_data->mpv, "aid", "no");
-    } else {
-        // Improved ID extraction: Look for "ID: " followed by digits
-        const char *id_start = strstr(label, "ID: ");
-        if (id_start) {
-            long long audio_id = strtoll(id_start + 4, NULL, 10); // Move past "ID: "
-            if (errno == ERANGE) {
-                fprintf(stderr, "Audio ID out of range: %s\n", label);
-                return; // Or handle the error as appropriate
-            }
-            mpv_set_property(app_data->mpv, "aid", MPV_FORMAT_INT64, &audio_id);
-        } else {
-            fprintf(stderr, "Could not extract audio ID from label: %s\n", label);
+    gint64 selected = 0;
+    for (guint i = 0; tracks && i < tracks->len; ++i) {
+        const TrackInfo *track = &g_array_index(tracks, TrackInfo, i);
+        if (track->type == type && track->selected) {
+            selected = track->id;
         }
     }
-}
-
-// Function to create the video track menu
-static GtkWidget *create_video_track_menu(AppData *app_data) {
-    if (cached_vmenu) {
-        gtk_widget_show_all(cached_vmenu);
-        return cached_vmenu;
+    if (tracks) {
+        g_array_unref(tracks);
     }
-    GtkWidget *menu = gtk_menu_new();
-    GtkWidget *none_item = gtk_menu_item_new_with_label("None");
-    g_signal_connect(none_item, "activate", G_CALLBACK(on_video_track_selected), app_data);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), none_item);
-    gtk_widget_show(none_item);
-
-    VideoTracks video_tracks = get_available_video_tracks(app_data->mpv);
-    if (video_tracks.tracks) {
-        for (int i = 0; i < video_tracks.count; ++i) {
-            GtkWidget *track_item = gtk_menu_item_new_with_label(video_tracks.tracks[i]);
-            g_signal_connect(track_item, "activate", G_CALLBACK(on_video_track_selected), app_data);
-            gtk_menu_shell_append(GTK_MENU_SHELL(menu), track_item);
-            gtk_widget_show(track_item);
-        }
-    }
-    //free_video_tracks(&video_tracks); // Reuse the subtitle track freeing function
-    VideoTrackCleanupData *cleanup = g_new0(VideoTrackCleanupData, 1);
-    cleanup->tracks = video_tracks;
-    g_object_weak_ref(G_OBJECT(menu), on_vmenu_destroyed, cleanup);
-    cached_vmenu = menu; // Save it for reuse
-    return menu;
-}
-
-// Function to create the audio track menu
-static GtkWidget *create_audio_track_menu(AppData *app_data) {
-    if (cached_amenu) {
-        gtk_widget_show_all(cached_amenu);
-        return cached_amenu;
+    if (selected != cached->selected) {
+        track_menu_mark(cached, app_data, selected);
     }
-    GtkWidget *menu = gtk_menu_new();
-    GtkWidget *none_item = gtk_menu_item_new_with_label("None");
-    g_signal_connect(none_item, "activate", G_CALLBACK(on_audio_track_selected), app_data);
-    gtk_menu_shell_append(GTK_MENU_SHELL(menu), none_item);
-    gtk_widget_show(none_item);
-
-    AudioTracks audio_tracks = get_available_audio_tracks(app_data->mpv);
-    if (audio_tracks.tracks) {
-        for (int i = 0; i < audio_tracks.count; ++i) {
-            GtkWidget *track_item = gtk_menu_item_new_with_label(audio_tracks.tracks[i]);
-            g_signal_connect(track_item, "activate", G_CALLBACK(on_audio_track_selected), app_data);
-            gtk_menu_shell_append(GTK_MENU_SHELL(menu), track_item);
-            gtk_widget_show(track_item);
-        }
-    }
-    //free_audio_tracks(&audio_tracks); // Reuse the subtitle track freeing function
-    AudioTrackCleanupData *cleanup = g_new0(AudioTrackCleanupData, 1);
-    cleanup->tracks = audio_tracks;
-    g_object_weak_ref(G_OBJECT(menu), on_amenu_destroyed, cleanup);
-    cached_amenu = menu;
-    return menu;
+    gtk_menu_popup_at_widget(GTK_MENU(cached->menu), button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
 }
 
-
+// Function to handle subtitle button clicks
+static void on_subtitle_button_clicked(GtkWidget *button, AppData *app_data) {
+    popup_track_menu(app_data, TRACK_SUB, button);
+}
 
 // Function to handle video track button clicks
 static void on_video_track_button_clicked(GtkWidget *button, AppData *app_data) {
-    GtkWidget *video_track_menu = create_video_track_menu(app_data);
-    gtk_menu_popup_at_widget(GTK_MENU(video_track_menu), button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
-    // GTK will handle destroying the menu when it's closed
+    popup_track_menu(app_data, TRACK_VIDEO, button);
 }
 
 // Function to handle audio track button clicks
 static void on_audio_track_button_clicked(GtkWidget *button, AppData *app_data) {
-    GtkWidget *audio_track_menu = create_audio_track_menu(app_data);
-    gtk_menu_popup_at_widget(GTK_MENU(audio_track_menu), button, GDK_GRAVITY_SOUTH_WEST, GDK_GRAVITY_NORTH_WEST, NULL);
-    // GTK will handle destroying the menu when it's closed
+    popup_track_menu(app_data, TRACK_AUDIO, button);
+}
+
+// Command line options (GTK's own options are left for gtk_init)
+static gboolean opt_no_gapless = FALSE;
+static gchar *opt_video_backend = NULL; // "x11", "sw" or NULL for automatic
+static gchar *opt_sw_scaler = NULL;     // ScaleMode name, NULL lets mpv scale
+static gboolean opt_bench_scaler = FALSE;
+static gboolean opt_bench_playlist = FALSE;
+static gboolean opt_resume = FALSE;
+
+static GOptionEntry option_entries[] = {
+    {"no-gapless", 0, 0, G_OPTION_ARG_NONE, &opt_no_gapless,
+     "Load each file on its own instead of through mpv's playlist", NULL},
+    {"video-backend", 0, 0, G_OPTION_ARG_STRING, &opt_video_backend,
+     "How video reaches the window: x11 (embedded) or sw (software render API)", "BACKEND"},
+    {"sw-scaler", 0, 0, G_OPTION_ARG_STRING, &opt_sw_scaler,
+     "Scale sw frames ourselves: nearest, bilinear or area", "MODE"},
+    {"bench-scaler", 0, 0, G_OPTION_ARG_NONE, &opt_bench_scaler,
+     "Check the SIMD scalers against the scalar one, print throughput and exit", NULL},
+    {"resume", 0, 0, G_OPTION_ARG_NONE, &opt_resume,
+     "Restore the playlist and position saved when the player last quit (ignored when files are given)", NULL},
+    {"bench-playlist", 0, 0, G_OPTION_ARG_NONE, &opt_bench_playlist,
+     "Time the playlist parser on generated multi-megabyte playlists and exit", NULL},
+    {"profile-startup", 0, 0, G_OPTION_ARG_NONE, &opt_profile_startup,
+     "Print how long each phase of startup took, up to the first file playing", NULL},
+    {"script-dir", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &opt_script_dirs,
+     "Load the Lua scripts in DIR, before the XDG script directories (repeatable)", "DIR"},
+    {NULL}
+};
+
+// mpv's core starts on its own thread while GTK connects to the display and
+// builds the window; main joins it just before it needs the handle. Only
+// options that don't depend on the display are set here: the video output
+// is picked once GTK is up, and still before any file opens.
+static gpointer mpv_startup_thread(gpointer data) {
+    mpv_handle *mpv = mpv_create();
+    if (!mpv) {
+        fprintf(stderr, "Error: could not create mpv client.\n");
+        return NULL;
+    }
+    if (!opt_no_gapless) {
+        // Open the next playlist entry's demuxer while the current one plays
+        mpv_set_option_string(mpv, "prefetch-playlist", "yes");
+    }
+    mpv_set_option_string(mpv, "sub-auto", "no"); // Sidecars are ours, see attach_subtitle_sidecars
+    mpv_set_option_string(mpv, "osc", "no");
+    mpv_set_option_string(mpv, "hwdec", "auto");
+    if (mpv_initialize(mpv) < 0) {
+        fprintf(stderr, "Failed to initialize mpv context.\n");
+        mpv_destroy(mpv);
+        return NULL;
+    }
+    startup_mark("mpv core initialized (background)");
+    return mpv;
+}
+
+// Error exit while mpv_startup_thread may still be running: wait for it and
+// tear down whatever it built. Returns main's exit status.
+static int abandon_mpv_startup(GThread *mpv_startup) {
+    mpv_handle *mpv = g_thread_join(mpv_startup);
+    if (mpv) {
+        mpv_destroy(mpv);
+    }
+    return 1;
 }
 
 int main(int argc, char *argv[]) {
+    startup_profile.start = g_get_monotonic_time();
     // 0. Force the locale *before* anything else
     setenv("LC_NUMERIC", "C", 1);
     printf("Current LC_NUMERIC: %s\n", setlocale(LC_NUMERIC, NULL));
 
+    GError *error = NULL;
+    GOptionContext *option_context = g_option_context_new("[FILE|FOLDER|PLAYLIST|GLOB...]");
+    g_option_context_add_main_entries(option_context, option_entries, NULL);
+    g_option_context_set_ignore_unknown_options(option_context, TRUE);
+    if (!g_option_context_parse(option_context, &argc, &argv, &error)) {
+        fprintf(stderr, "%s\n", error->message);
+        g_error_free(error);
+        g_option_context_free(option_context);
+        return 1;
+    }
+    g_option_context_free(option_context);
+    if (opt_bench_scaler) {
+        return run_scaler_benchmark();
+    }
+    if (opt_bench_playlist) {
+        return run_playlist_benchmark();
+    }
+    startup_mark("options parsed");
+
+    // The locale is settled before the mpv thread starts: setlocale is not
+    // thread-safe, and mpv refuses a numeric locale other than C
+    setlocale(LC_ALL, "");
+    setlocale(LC_NUMERIC, "C");
+    gtk_disable_setlocale();
+    GThread *mpv_startup = g_thread_new("mpv_startup", mpv_startup_thread, NULL);
+
     // 1. Initialize GTK+
-    gtk_init(&argc, &argv);
     if (!gtk_init_check(&argc, &argv)) {
         fprintf(stderr, "GTK initialization failed.\n");
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
+    startup_mark("GTK initialized");
 
     // 2. Create the main window
     GtkWidget *window = gtk_window_new(GTK_WINDOW_TOPLEVEL);
     if (!window) {
         fprintf(stderr, "Failed to create main window.\n");
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_window_set_title(GTK_WINDOW(window), "Eluxi-Player");
     gtk_window_set_default_size(GTK_WINDOW(window), 800, 600);
     g_signal_connect(window, "destroy", G_CALLBACK(gtk_main_quit), NULL);
 
-
-    // Create a CSS provider
-    GtkCssProvider *cssProvider = gtk_css_provider_new();
-    if (!cssProvider) {
-        fprintf(stderr, "Failed to create CSS provider.\n");
-        return 1;
-    }
-
-    // Load CSS
-    if (gtk_css_provider_load_from_data(cssProvider,
-                                      ".playing-video { color: royalblue; }",
-                                      -1, NULL) == FALSE) {
-        fprintf(stderr, "Failed to load CSS.\n");
-        g_object_unref(cssProvider);
-        return 1;
-    }
-
-    // Apply the CSS to the application's style context
-    gtk_style_context_add_provider_for_screen(
-        gdk_screen_get_default(), // Get the default screen
-        GTK_STYLE_PROVIDER(cssProvider),
-        GTK_STYLE_PROVIDER_PRIORITY_USER);
-
-    g_object_unref(cssProvider);
-
     // 3. Create a vertical box to hold widgets
     GtkWidget *vbox = gtk_box_new(GTK_ORIENTATION_VERTICAL, 0);
     if (!vbox) {
         fprintf(stderr, "Failed to create vbox.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_container_add(GTK_CONTAINER(window), vbox);
 
@@ -1407,7 +5655,7 @@ GtkWidget *hboxa = gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 0);
 if (!hboxa) {
     fprintf(stderr, "Failed to create hboxa.\n");
     gtk_widget_destroy(window);
-    return 1;
+    return abandon_mpv_startup(mpv_startup);
 }
 
     // 4. Create the drawing area for video
@@ -1415,7 +5663,7 @@ if (!hboxa) {
     if (!drawing_area) {
         fprintf(stderr, "Failed to create drawing area.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_widget_set_size_request(drawing_area, 800, 600);
     gtk_widget_set_hexpand(drawing_area, TRUE);
@@ -1423,19 +5671,10 @@ if (!hboxa) {
     //gtk_box_pack_start(GTK_BOX(vbox), drawing_area, TRUE, TRUE, 0);
 
 
-    
-        //Queue-list widget for playlist
-        GtkWidget *playlist_box = gtk_box_new(GTK_ORIENTATION_VERTICAL, 5);
-        //gtk_widget_set_size_request(playlist_box, 400, 300);  // Set an appropriate size
-        //gtk_widget_set_visible(playlist_box, FALSE);  // Initially hidden
-        //gtk_box_pack_start(GTK_BOX(hbox), playlist_box, TRUE, TRUE, 0);
 
             // 4. Pack the video panel (drawing_area) into hboxa
 gtk_box_pack_start(GTK_BOX(hboxa), drawing_area, TRUE, TRUE, 0);
 
-// 5. Pack the playlist box into hboxa (will appear to the right of drawing_area)
-//gtk_box_pack_start(GTK_BOX(hboxa), playlist_box, FALSE, FALSE, 0);  // FALSE ensures it doesn't expand
-
 // 6. Add hboxa to the main vbox
 gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
 
@@ -1444,7 +5683,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!slider_hbox) {
         fprintf(stderr, "Failed to create slider_hbox.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_box_pack_start(GTK_BOX(vbox), slider_hbox, FALSE, FALSE, 5);
 
@@ -1453,7 +5692,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!hbox) {
         fprintf(stderr, "Failed to create hbox.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_box_pack_start(GTK_BOX(vbox), hbox, FALSE, FALSE, 0);
 
@@ -1466,7 +5705,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!play_button) {
         fprintf(stderr, "Failed to create play button.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     // gtk_box_pack_start(GTK_BOX(hbox), play_button, FALSE, FALSE, 0); // REMOVE THIS LINE
 
@@ -1478,7 +5717,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!stop_button) {
         fprintf(stderr, "Failed to create stop button.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     // gtk_box_pack_start(GTK_BOX(hbox), stop_button, FALSE, FALSE, 0); // REMOVE THIS LINE
 
@@ -1490,20 +5729,29 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!file_button) {
         fprintf(stderr, "Failed to create file button.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     // gtk_box_pack_start(GTK_BOX(hbox), file_button, FALSE, FALSE, 0); // REMOVE THIS LINE
 
+    // Folder import button, next to the file chooser
+    GtkWidget *folder_icon = gtk_image_new_from_icon_name("folder-open", GTK_ICON_SIZE_BUTTON);
+    GtkWidget *folder_button = gtk_button_new();
+    gtk_button_set_image(GTK_BUTTON(folder_button), folder_icon);
+    gtk_widget_set_tooltip_text(folder_button, "Open folder");
+    gtk_box_pack_start(GTK_BOX(hbox), folder_button, FALSE, FALSE, 0);
+
 
 
     // Create the slider
-    GtkWidget *slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 100, 1);
+    // Timeline in seconds with millisecond steps, so single frames can be reached
+    GtkWidget *slider = gtk_scale_new_with_range(GTK_ORIENTATION_HORIZONTAL, 0, 100, 0.001);
     if (!slider) {
         fprintf(stderr, "Failed to create slider.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_scale_set_draw_value(GTK_SCALE(slider), FALSE);
+    gtk_range_set_round_digits(GTK_RANGE(slider), 3);
     gtk_widget_set_hexpand(slider, TRUE);
     gtk_box_pack_start(GTK_BOX(slider_hbox), slider, TRUE, TRUE, 5);
 
@@ -1512,7 +5760,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!duration_label) {
         fprintf(stderr, "Failed to create duration label.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_box_pack_start(GTK_BOX(slider_hbox), duration_label, FALSE, FALSE, 5);
 
@@ -1521,7 +5769,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!volume_hbox) {
         fprintf(stderr, "Failed to create volume hbox.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
 
     // Create a horizontal slider for volume control
@@ -1529,7 +5777,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!volume_slider) {
         fprintf(stderr, "Failed to create volume slider.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     gtk_scale_set_draw_value(GTK_SCALE(volume_slider), FALSE);
     gtk_widget_set_size_request(volume_slider, 150, 30);
@@ -1538,7 +5786,7 @@ gtk_box_pack_start(GTK_BOX(vbox), hboxa, TRUE, TRUE, 0);
     if (!volume_icon) {
         fprintf(stderr, "Failed to create volume icon.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
 
     GtkWidget *subtitle_icon = gtk_image_new_from_icon_name("text-plain", GTK_ICON_SIZE_BUTTON);
@@ -1548,7 +5796,7 @@ gtk_box_pack_start(GTK_BOX(hbox), subtitle_button, FALSE, FALSE, 0);
 if (!subtitle_button) {
     fprintf(stderr, "Failed to create subtitle button.\n");
     gtk_widget_destroy(window);
-    return 1;
+    return abandon_mpv_startup(mpv_startup);
 }
 
     // Video track button
@@ -1585,7 +5833,7 @@ if (!subtitle_button) {
     if (!fullscreen_button) {
         fprintf(stderr, "Failed to create file button.\n");
         gtk_widget_destroy(window);
-        return 1;
+        return abandon_mpv_startup(mpv_startup);
     }
     //gtk_box_pack_start(GTK_BOX(vbox), volume_hbox, FALSE, FALSE, 0); // Removed from here
 
@@ -1613,7 +5861,6 @@ if (!subtitle_button) {
     // Show the playlist when hovering
     // Connect key press event to the window
     gtk_widget_add_events(window, GDK_KEY_PRESS_MASK);
-    g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), playlist_box);
 
     //g_signal_connect(hover_box, "enter-notify-event", G_CALLBACK(on_hover_enter), playlist_box);
    // g_signal_connect(hover_box, "leave-notify-event", G_CALLBACK(on_hover_leave), playlist_box);
@@ -1657,22 +5904,32 @@ if (!subtitle_button) {
     g_signal_connect(target_widget, "motion-notify-event", G_CALLBACK(reset_cursor_timer), NULL);
 
 
-    // 9. Initialize MPV
-    mpv_handle *mpv = mpv_create();
+    playlist_init();
+    startup_mark("widgets built");
+
+    // 9. Pick up mpv, started in the background above
+    mpv_handle *mpv = g_thread_join(mpv_startup);
+    startup_mark("mpv core joined");
     if (!mpv) {
-        fprintf(stderr, "Error: could not create mpv client.\n");
         gtk_widget_destroy(window);
         return 1;
     }
-    if (mpv_initialize(mpv) < 0) {
-        fprintf(stderr, "Failed to initialize mpv context.\n");
-        mpv_destroy(mpv);
-        gtk_widget_destroy(window);
-        return 1;
+    // Embedding through wid needs X11; anywhere else (Wayland, broadway...)
+    // mpv renders into memory and we draw the frames ourselves.
+    gboolean sw_render = !GDK_IS_X11_DISPLAY(gdk_display_get_default());
+    if (g_strcmp0(opt_video_backend, "sw") == 0) {
+        sw_render = TRUE;
+    } else if (g_strcmp0(opt_video_backend, "x11") == 0 && sw_render) {
+        fprintf(stderr, "The x11 video backend needs an X11 display, using sw instead.\n");
+    } else if (opt_video_backend && g_strcmp0(opt_video_backend, "x11") != 0) {
+        fprintf(stderr, "Unknown video backend '%s', choosing automatically.\n", opt_video_backend);
+    }
+    if (sw_render) {
+        mpv_set_option_string(mpv, "vo", "libmpv");
     }
     
     // 10. Set up AppData and connect signals
-    AppData app_data;
+    AppData app_data = {0};
     app_data.mpv = mpv;
     app_data.window = window;
     app_data.drawing_area = drawing_area;
@@ -1681,66 +5938,158 @@ if (!subtitle_button) {
     app_data.play_button = play_button;
     app_data.stop_button = stop_button;
     app_data.file_button = file_button;
+    app_data.folder_button = folder_button;
     app_data.slider = slider;
     app_data.duration_label = duration_label;
+    app_data.shown_position_sec = -1;
+    app_data.shown_duration_sec = -1;
     app_data.slider_dragging = FALSE;
     app_data.volume_slider = volume_slider;
     app_data.volume_icon = volume_icon;
-    app_data.playlist_box = playlist_box;
     app_data.hover_box = hover_box;
     app_data.fullscreen_button = fullscreen_button;
     app_data.fullscreen_icon = fullscreen_icon;
     app_data.playlist_button = playlist_button; // Store it in AppData
     app_data.video_track_button = video_track_button; // Store in AppData
     app_data.audio_track_button = audio_track_button; // Store in AppData
-
-    g_signal_connect(drawing_area, "draw", G_CALLBACK(on_draw), &app_data);
+    app_data.gapless = !opt_no_gapless;
+    app_data.sw_render = sw_render;
+    app_data.frames.scale_mode = -1;
+    for (int mode = 0; opt_sw_scaler && mode < SCALE_MODE_COUNT; ++mode) {
+        if (strcmp(opt_sw_scaler, scale_mode_names[mode]) == 0) {
+            app_data.frames.scale_mode = mode;
+        }
+    }
+    if (opt_sw_scaler && app_data.frames.scale_mode < 0) {
+        fprintf(stderr, "Unknown scaler '%s', letting mpv scale.\n", opt_sw_scaler);
+    }
+    if (sw_render && !create_sw_render_context(&app_data)) {
+        mpv_destroy(mpv);
+        gtk_widget_destroy(window);
+        return 1;
+    }
+    g_mutex_init(&app_data.pending_lock);
+    g_mutex_init(&app_data.watched_lock);
+    app_data.pending_requests = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                                         (GDestroyNotify)free_pending_request);
+    app_data.next_reply_id = ASYNC_REPLY_BASE;
+    create_playlist_view(&app_data); // Playlist popover hangs off playlist_button
+    metadata_prober_init(&app_data);
+    watch_later_init(); // Before any file can open: the on_load hook reads it
+    sidecar_init();
+    thumbnailer_init();
+    create_seek_preview(&app_data);
+
+    if (sw_render) {
+        g_signal_connect(drawing_area, "draw", G_CALLBACK(on_draw_frame), &app_data);
+        g_signal_connect(drawing_area, "size-allocate", G_CALLBACK(on_drawing_area_size_allocate), &app_data);
+        g_signal_connect(drawing_area, "notify::scale-factor", G_CALLBACK(on_drawing_area_scale_changed), &app_data);
+    } else {
+        g_signal_connect(drawing_area, "draw", G_CALLBACK(on_draw), &app_data);
+    }
     g_signal_connect(drawing_area, "realize", G_CALLBACK(on_drawing_area_realized), &app_data);
     g_signal_connect(play_button, "clicked", G_CALLBACK(on_play_pause_clicked), &app_data);
     g_signal_connect(stop_button, "clicked", G_CALLBACK(on_stop_clicked), &app_data);
     g_signal_connect(file_button, "clicked", G_CALLBACK(on_file_open_clicked), &app_data);
+    g_signal_connect(folder_button, "clicked", G_CALLBACK(on_folder_open_clicked), &app_data);
     g_signal_connect(fullscreen_button, "clicked", G_CALLBACK(toggle_fullscreen_via_button), &app_data);
     g_signal_connect(slider, "button-press-event", G_CALLBACK(on_slider_pressed), &app_data);
     g_signal_connect(slider, "button-release-event", G_CALLBACK(on_slider_released), &app_data);
     g_signal_connect(slider, "value-changed", G_CALLBACK(on_slider_moved), &app_data);
     g_signal_connect(volume_slider, "value-changed", G_CALLBACK(on_volume_changed), &app_data);
     g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press_space), &app_data);
+    g_signal_connect(window, "key-press-event", G_CALLBACK(on_key_press), &app_data);
     g_signal_connect(subtitle_button, "clicked", G_CALLBACK(on_subtitle_button_clicked), &app_data);
     g_signal_connect(playlist_button, "clicked", G_CALLBACK(on_playlist_button_clicked), &app_data);
     g_signal_connect(video_track_button, "clicked", G_CALLBACK(on_video_track_button_clicked), &app_data);
     g_signal_connect(audio_track_button, "clicked", G_CALLBACK(on_audio_track_button_clicked), &app_data);
-    load_lua_scripts(mpv);  //  <--  Load the scripts here
+    register_property_observers(mpv);
+    mpv_hook_add(mpv, 0, "on_load", 0); // See run_load_hook
+    mpv_hook_add(mpv, 0, "on_preloaded", 0);
+    mpv_hook_add(mpv, 0, "on_unload", 0);
+    // Realized now rather than when the window shows, so wid is set before
+    // any file below is queued and the first file opens straight into it
+    gtk_widget_realize(drawing_area);
     // 12. Create a thread to handle MPV events
-    GThread *mpv_thread = g_thread_new("mpv_event_thread", (GThreadFunc)handle_mpv_events, &app_data);
+    // mpv pokes the wakeup source instead of the thread polling mpv_wait_event
+    app_data.mpv_event_context = g_main_context_new();
+    app_data.mpv_event_loop = g_main_loop_new(app_data.mpv_event_context, FALSE);
+    app_data.mpv_event_source = g_source_new(&mpv_event_source_funcs, sizeof(GSource));
+    g_source_set_callback(app_data.mpv_event_source, handle_mpv_events, &app_data, NULL);
+    g_source_attach(app_data.mpv_event_source, app_data.mpv_event_context);
+    mpv_set_wakeup_callback(mpv, on_mpv_wakeup, &app_data);
+    g_source_set_ready_time(app_data.mpv_event_source, 0); // Pick up anything queued already
+
+    GThread *mpv_thread = g_thread_new("mpv_event_thread", mpv_event_thread, &app_data);
     if (!mpv_thread) {
         fprintf(stderr, "Error creating MPV event thread.\n");
         mpv_destroy(mpv);
         gtk_widget_destroy(window);
         return 1;
     }
+    startup_mark("event thread started");
+    load_lua_scripts(&app_data); // Queued ahead of any file, so scripts see the first one open
 
-    // 13. Load file from command line
+    // 13. Queue everything named on the command line; it is expanded in the background.
+    // Otherwise pick up the last session if asked to, before the window shows.
+    double initial_volume = 100; // Max unless the session says otherwise
+    gboolean expect_playback = argc > 1;
     if (argc > 1) {
-        load_file_in_mpv(mpv, argv[1]);
+        folder_import_start(&app_data, argv + 1);
+    } else if (opt_resume) {
+        expect_playback = session_restore(&app_data, &initial_volume) && playlist_current_entry();
     }
 
-    // Set initial volume to max (100)
-    mpv_set_property(mpv, "volume", MPV_FORMAT_DOUBLE, &(double){100});
-    gtk_range_set_value(GTK_RANGE(volume_slider), 100);
+    async_set_property(&app_data, "volume", MPV_FORMAT_DOUBLE, &initial_volume, NULL, NULL);
+    gtk_range_set_value(GTK_RANGE(volume_slider), initial_volume);
 
 
     // 14. Show the window *before* entering the main loop
     gtk_widget_show_all(window);
-    toggle_playlist_visibility(playlist_box);
+    startup_mark("window shown");
+    if (!expect_playback) {
+        g_idle_add(report_startup_when_idle, NULL); // Runs after the first redraw
+    }
     // 15. Start the GTK+ main loop
-    g_timeout_add(500, (GSourceFunc)update_slider, &app_data);
     gtk_main();
 
     // 16. Clean up
+    startup_profile_report("quit before anything played");
+    if (app_data.session_timer) {
+        g_source_remove(app_data.session_timer);
+    }
+    if (app_data.session_save_id) {
+        g_source_remove(app_data.session_save_id);
+    }
+    session_save(&app_data, TRUE); // Also picks up durations probed since the last write
+    PlayerSnapshot watched;
+    watched_read(&app_data, &watched);
+    watch_later_remember(&watched);
+    folder_import_shutdown();
+    metadata_prober_shutdown(); // Also writes the metadata cache
+    thumbnailer_shutdown();
+    if (app_data.render_ctx) {
+        destroy_sw_render_context(&app_data); // Must go before the mpv handle
+    }
     mpv_command(mpv, (const char *[]){"quit", NULL});
     g_thread_join(mpv_thread);
+    mpv_set_wakeup_callback(mpv, NULL, NULL);
+    g_source_destroy(app_data.mpv_event_source);
+    g_source_unref(app_data.mpv_event_source);
+    g_main_loop_unref(app_data.mpv_event_loop);
+    g_main_context_unref(app_data.mpv_event_context);
     mpv_destroy(mpv);
-    g_free(video_queue);
+    watch_later_shutdown(); // The hook can no longer run
+    sidecar_shutdown();
+    track_model_shutdown();
+    g_array_free(playlist.entries, TRUE);
+    g_hash_table_destroy(playlist.index_of);
+    g_hash_table_destroy(app_data.pending_requests); // Requests mpv never answered
+    if (app_data.resume) {
+        session_resume_free(app_data.resume); // The saved file never started
+    }
+    g_mutex_clear(&app_data.pending_lock);
+    g_mutex_clear(&app_data.watched_lock);
     return 0;
 }
 